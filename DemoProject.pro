@@ -1,4 +1,4 @@
-QT       += core gui xml
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -9,23 +9,55 @@ CONFIG += c++11
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    anchorindex.cpp \
     arrow.cpp \
+    arrowbundles.cpp \
+    binarydocument.cpp \
+    compresseddocument.cpp \
+    connectorrouter.cpp \
     customitem.cpp \
+    custompixmapitem.cpp \
     customscene.cpp \
     customtextitem.cpp \
     customview.cpp \
+    documentloader.cpp \
+    documentsaver.cpp \
+    imagestore.cpp \
+    itemstate.cpp \
+    levelofdetail.cpp \
     main.cpp \
     mainwindow.cpp \
-    undosystem.cpp
+    paralleldecode.cpp \
+    scenepager.cpp \
+    shapegeometry.cpp \
+    undojournal.cpp \
+    undosystem.cpp \
+    xmldocument.cpp
 
 HEADERS += \
+    anchorindex.h \
     arrow.h \
+    arrowbundles.h \
+    binarydocument.h \
+    compresseddocument.h \
+    connectorrouter.h \
     customitem.h \
+    custompixmapitem.h \
     customscene.h \
     customtextitem.h \
     customview.h \
+    documentloader.h \
+    documentsaver.h \
+    imagestore.h \
+    itemstate.h \
+    levelofdetail.h \
     mainwindow.h \
-    undosystem.h
+    paralleldecode.h \
+    scenepager.h \
+    shapegeometry.h \
+    undojournal.h \
+    undosystem.h \
+    xmldocument.h
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
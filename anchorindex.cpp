@@ -0,0 +1,95 @@
+#include "anchorindex.h"
+
+void AnchorIndex::insert(QGraphicsItem *item, const QPointF &anchor)
+{
+    if (anchors.contains(item))
+    {
+        move(item, anchor);
+        return;
+    }
+    anchors.insert(item, anchor);
+    xs.insert(key(anchor.x()), item);
+    ys.insert(key(anchor.y()), item);
+}
+
+void AnchorIndex::remove(QGraphicsItem *item)
+{
+    QHash<QGraphicsItem*, QPointF>::iterator it = anchors.find(item);
+    if (it == anchors.end())
+        return;
+    xs.remove(key(it->x()), item);
+    ys.remove(key(it->y()), item);
+    anchors.erase(it);
+}
+
+void AnchorIndex::move(QGraphicsItem *item, const QPointF &anchor)
+{
+    QHash<QGraphicsItem*, QPointF>::iterator it = anchors.find(item);
+    if (it == anchors.end())
+        return;
+    if (key(it->x()) != key(anchor.x()))
+    {
+        xs.remove(key(it->x()), item);
+        xs.insert(key(anchor.x()), item);
+    }
+    if (key(it->y()) != key(anchor.y()))
+    {
+        ys.remove(key(it->y()), item);
+        ys.insert(key(anchor.y()), item);
+    }
+    *it = anchor;
+}
+
+bool AnchorIndex::nearestX(qreal x, qreal delta, const QSet<QGraphicsItem*> &excluded, qreal *found) const
+{
+    return nearest(xs, x, delta, excluded, found);
+}
+
+bool AnchorIndex::nearestY(qreal y, qreal delta, const QSet<QGraphicsItem*> &excluded, qreal *found) const
+{
+    return nearest(ys, y, delta, excluded, found);
+}
+
+bool AnchorIndex::nearest(const QMultiMap<qint64, QGraphicsItem*> &index, qreal value, qreal delta,
+                          const QSet<QGraphicsItem*> &excluded, qreal *found)
+{
+    // outwards from value, the nearer side first, so the first anchor that
+    // is not excluded is the nearest one; anchors that share a key are
+    // not looked at beyond it
+    qint64 center = key(value);
+    qint64 range = qint64(delta * Resolution);
+    QMultiMap<qint64, QGraphicsItem*>::const_iterator above = index.lowerBound(center);
+    QMultiMap<qint64, QGraphicsItem*>::const_iterator below = above;
+    for (;;)
+    {
+        qint64 up = above != index.constEnd() ? above.key() - center : range + 1;
+        qint64 down = range + 1;
+        if (below != index.constBegin())
+        {
+            QMultiMap<qint64, QGraphicsItem*>::const_iterator next = below;
+            down = center - (--next).key();
+        }
+        if (up > range && down > range)
+            return false;
+
+        QGraphicsItem *item;
+        qint64 at;
+        if (up < down)
+        {
+            item = above.value();
+            at = above.key();
+            ++above;
+        }
+        else
+        {
+            --below;
+            item = below.value();
+            at = below.key();
+        }
+        if (!excluded.contains(item))
+        {
+            *found = qreal(at) / Resolution;
+            return true;
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef ANCHORINDEX_H
+#define ANCHORINDEX_H
+
+#include <QHash>
+#include <QMultiMap>
+#include <QPointF>
+#include <QSet>
+#include <QtGlobal>
+
+class QGraphicsItem;
+
+// Sorted x and y coordinates of the shape anchors (their scene positions),
+// kept up to date as shapes are added, moved and removed. Alignment and
+// snap candidates are found by a range query on one axis instead of a
+// walk over every item in the scene. Coordinates are keyed in fixed point,
+// so positions snapped to the grid compare exactly.
+class AnchorIndex
+{
+public:
+    static const int Resolution = 1024;     // keys per scene unit
+
+    void insert(QGraphicsItem *item, const QPointF &anchor);
+    void remove(QGraphicsItem *item);
+    void move(QGraphicsItem *item, const QPointF &anchor);
+    int size() const { return anchors.size(); }
+
+    // The anchor coordinate closest to x (or y) and at most delta away,
+    // ignoring the excluded items; a delta of 0 asks for an exact match.
+    // Returns false if there is none.
+    bool nearestX(qreal x, qreal delta, QSet<QGraphicsItem*> const& excluded, qreal *found) const;
+    bool nearestY(qreal y, qreal delta, QSet<QGraphicsItem*> const& excluded, qreal *found) const;
+
+private:
+    static qint64 key(qreal value) { return qRound64(value * Resolution); }
+    static bool nearest(QMultiMap<qint64, QGraphicsItem*> const& index, qreal value, qreal delta,
+                        QSet<QGraphicsItem*> const& excluded, qreal *found);
+
+    QMultiMap<qint64, QGraphicsItem*> xs;
+    QMultiMap<qint64, QGraphicsItem*> ys;
+    QHash<QGraphicsItem*, QPointF> anchors;
+};
+
+#endif // ANCHORINDEX_H
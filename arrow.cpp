@@ -1,5 +1,8 @@
 #include "arrow.h"
 #include "customitem.h"
+#include "customscene.h"
+#include "itemstate.h"
+#include "levelofdetail.h"
 
 #include <math.h>
 #include <QPen>
@@ -12,28 +15,113 @@ Arrow::Arrow(CustomItem *startItem, CustomItem *endItem, QGraphicsItem *parent)
 {
     myStartItem = startItem;
     myEndItem = endItem;
+    myId = ItemState::allocateId();
     setFlag(QGraphicsItem::ItemIsSelectable, true);
     myColor = Qt::black;
     setPen(QPen(myColor, 2, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
 }
 
+Arrow::~Arrow()
+{
+    if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+        customScene->unregisterItem(this);
+}
+
+void Arrow::setId(int id)
+{
+    myId = id;
+    ItemState::reserveId(id);
+}
+
 QRectF Arrow::boundingRect() const
 {
     qreal extra = (pen().width() + 20) / 2.0;
 
-    return QRectF(line().p1(), QSizeF(line().p2().x() - line().p1().x(),
-                                      line().p2().y() - line().p1().y()))
-            .normalized()
-            .adjusted(-extra, -extra, extra, extra);
+    QRectF rect = QRectF(line().p1(), QSizeF(line().p2().x() - line().p1().x(),
+                                             line().p2().y() - line().p1().y()))
+            .normalized();
+    if (!myRoute.isEmpty())
+        rect = rect.united(myRoute.boundingRect());
+    return rect.adjusted(-extra, -extra, extra, extra);
 }
 
 QPainterPath Arrow::shape() const
 {
-    QPainterPath path = QGraphicsLineItem::shape();
+    QPainterPath path;
+    if (myRoute.isEmpty())
+    {
+        path = QGraphicsLineItem::shape();
+    }
+    else
+    {
+        QPainterPath polyline;
+        polyline.addPolygon(myRoute);
+        QPainterPathStroker stroker;
+        stroker.setWidth(pen().widthF());
+        path = stroker.createStroke(polyline);
+    }
     path.addPolygon(arrowHead);
     return path;
 }
 
+void Arrow::setRoute(const QPolygonF &route)
+{
+    prepareGeometryChange();
+    routedFrom = myStartItem->sceneBoundingRect();
+    routedTo = myEndItem->sceneBoundingRect();
+    // a route saved before its endpoints moved no longer reaches them
+    bool attached = route.size() >= 2
+            && routedFrom.adjusted(-1, -1, 1, 1).contains(route.first())
+            && routedTo.adjusted(-1, -1, 1, 1).contains(route.last());
+    myRoute = attached ? clippedRoute(route) : QPolygonF();
+    updatePosition();
+    update();
+}
+
+QPolygonF Arrow::clippedRoute(const QPolygonF &route)
+{
+    // from where the route last leaves the start shape to where it first
+    // enters the end shape
+    if (route.size() < 2)
+        return QPolygonF();
+    int first = 0;
+    for (int i = 0; i < route.size(); ++i)
+    {
+        if (myStartItem->contains(myStartItem->mapFromScene(route.at(i))))
+            first = i;
+    }
+    int last = route.size() - 1;
+    for (int i = route.size() - 1; i > first; --i)
+    {
+        if (myEndItem->contains(myEndItem->mapFromScene(route.at(i))))
+            last = i;
+    }
+    if (first >= last)
+        return QPolygonF();
+
+    QPolygonF clipped = route.mid(first, last - first + 1);
+    QPointF exit = calculateIntersectionPoint(myStartItem, QLineF(clipped.at(1), clipped.at(0)));
+    if (!exit.isNull())
+        clipped[0] = exit;
+    QPointF entry = calculateIntersectionPoint(myEndItem, QLineF(clipped.at(clipped.size() - 2), clipped.last()));
+    if (!entry.isNull())
+        clipped.last() = entry;
+    return clipped;
+}
+
+bool Arrow::routeCrosses(const QRectF &rect) const
+{
+    // the segments are horizontal or vertical, so their bounds are exact
+    for (int i = 1; i < myRoute.size(); ++i)
+    {
+        QRectF segment = QRectF(myRoute.at(i - 1), myRoute.at(i)).normalized();
+        if (segment.left() <= rect.right() && segment.right() >= rect.left()
+                && segment.top() <= rect.bottom() && segment.bottom() >= rect.top())
+            return true;
+    }
+    return false;
+}
+
 bool Arrow::operator==(Arrow &arrow)
 {
     return (startItem() == arrow.startItem()) && (endItem() == arrow.endItem());
@@ -41,51 +129,93 @@ bool Arrow::operator==(Arrow &arrow)
 
 void Arrow::updatePosition()
 {
-    QLineF line(mapFromItem(myStartItem, 0, 0), mapFromItem(myEndItem, 0, 0));
-    setLine(line);
+    // The clipped line and the head are worked out here, when an endpoint
+    // moves or changes shape, so that painting only draws them.
+    if (!myRoute.isEmpty() && (myStartItem->sceneBoundingRect() != routedFrom
+                               || myEndItem->sceneBoundingRect() != routedTo))
+    {
+        // stale until the router has been round again
+        prepareGeometryChange();
+        myRoute.clear();
+    }
+    endpointsOverlap = myStartItem->collidesWithItem(myEndItem);
+    QLineF centerLine(myStartItem->pos(), myEndItem->pos());
+    arrowHead.clear();
+    if (!endpointsOverlap)
+    {
+        // Calculate intersection points with the start item
+        QPointF startIntersectPoint = calculateIntersectionPoint(myStartItem, centerLine);
+        if (!startIntersectPoint.isNull())
+            centerLine.setP1(startIntersectPoint);
+
+        // Calculate intersection points with the end item
+        QPointF endIntersectPoint = calculateIntersectionPoint(myEndItem, centerLine);
+        if (!endIntersectPoint.isNull())
+            centerLine.setP2(endIntersectPoint);
+    }
+    setLine(centerLine);
+    // a routed arrow's head sits on its first segment
+    QLineF headLine = myRoute.isEmpty() ? centerLine : QLineF(myRoute.at(0), myRoute.at(1));
+    if (endpointsOverlap || headLine.length() == 0)
+    {
+        endpointsOverlap = true;
+        return;
+    }
+
+    qreal arrowSize = 10;
+//    double angle = std::atan2(-line().dy(), line().dx());
+    double angle = ::acos(headLine.dx() / headLine.length());
+    if (headLine.dy() >= 0)
+        angle = (Pi * 2) - angle;
+
+    QPointF arrowP1 = headLine.p1() + QPointF(sin(angle + Pi / 3) * arrowSize,
+                                              cos(angle + Pi / 3) * arrowSize);
+    QPointF arrowP2 = headLine.p1() + QPointF(sin(angle + Pi - Pi / 3) * arrowSize,
+                                              cos(angle + Pi - Pi / 3) * arrowSize);
+    arrowHead << headLine.p1() << arrowP1 << arrowP2;
 }
 
 void Arrow::paint(QPainter *painter, const QStyleOptionGraphicsItem *,
                   QWidget *)
 {
-    if (myStartItem->collidesWithItem(myEndItem))
+    if (endpointsOverlap)
         return;
 
+    // zoomed out, a plain hairline; the end circles would only be specks
+    if (LevelOfDetail::tier(painter) != LevelOfDetail::Full)
+    {
+        painter->setRenderHint(QPainter::Antialiasing, false);
+        painter->setPen(QPen(myColor, 0));
+        if (!myRoute.isEmpty())
+            painter->drawPolyline(myRoute);
+        else
+            painter->drawLine(line());
+        return;
+    }
+
     QPen myPen = pen();
     myPen.setColor(myColor);
-    qreal arrowSize = 10;
     painter->setPen(myPen);
     painter->setBrush(myColor);
 
-    QLineF centerLine(myStartItem->pos(), myEndItem->pos());
-
-    // Calculate intersection points with the start item
-    QPolygonF startPolygon = myStartItem->polygon();
-    QPointF startIntersectPoint = calculateIntersectionPoint(startPolygon, myStartItem, centerLine);
-    if (!startIntersectPoint.isNull())
-        centerLine.setP1(startIntersectPoint);
-
-    // Calculate intersection points with the end item
-    QPolygonF endPolygon = myEndItem->polygon();
-    QPointF endIntersectPoint = calculateIntersectionPoint(endPolygon, myEndItem, centerLine);
-    if (!endIntersectPoint.isNull())
-        centerLine.setP2(endIntersectPoint);
-
-    setLine(centerLine);
-
-//    double angle = std::atan2(-line().dy(), line().dx());
-    double angle = ::acos(line().dx() / line().length());
-    if (line().dy() >= 0)
-        angle = (Pi * 2) - angle;
-
+    if (!myRoute.isEmpty())
+    {
+        painter->setBrush(Qt::NoBrush);
+        painter->drawPolyline(myRoute);
 
-    QPointF arrowP1 = line().p1() + QPointF(sin(angle + Pi / 3) * arrowSize,
-                                            cos(angle + Pi / 3) * arrowSize);
-    QPointF arrowP2 = line().p1() + QPointF(sin(angle + Pi - Pi / 3) * arrowSize,
-                                            cos(angle + Pi - Pi / 3) * arrowSize);
+        painter->setBrush(Qt::black);
+        painter->drawEllipse(myRoute.first(), 3, 3);
+        painter->drawEllipse(myRoute.last(), 3, 3);
 
-    arrowHead.clear();
-    arrowHead << line().p1() << arrowP1 << arrowP2;
+        if (isSelected())
+        {
+            painter->setPen(QPen(myColor, 1, Qt::DashLine));
+            painter->setBrush(Qt::NoBrush);
+            painter->drawPolyline(myRoute.translated(0, 4.0));
+            painter->drawPolyline(myRoute.translated(0, -4.0));
+        }
+        return;
+    }
 
     painter->drawLine(line());
 //    painter->drawPolygon(arrowHead);
@@ -106,20 +236,38 @@ void Arrow::paint(QPainter *painter, const QStyleOptionGraphicsItem *,
     }
 }
 
-QPointF Arrow::calculateIntersectionPoint(const QPolygonF &polygon, CustomItem *item, const QLineF &line)
+QVariant Arrow::itemChange(GraphicsItemChange change, const QVariant &value)
 {
-    QPointF p1 = polygon.first() + item->pos();
-    QPointF p2;
-    QPointF intersectPoint;
-    QLineF polyLine;
-    for (int i = 1; i < polygon.count(); i++)
+    if (change == QGraphicsItem::ItemSelectedHasChanged)
     {
-        p2 = polygon.at(i) + item->pos();
-        polyLine = QLineF(p1, p2);
-        QLineF::IntersectType intersectType = polyLine.intersect(line, &intersectPoint);
-        if (intersectType == QLineF::BoundedIntersection)
-            return intersectPoint;
-        p1 = p2;
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+        {
+            customScene->itemSelectionChanged(this, value.toBool());
+            // a selected arrow leaves its bundle and paints itself
+            if (customScene->bundlesArrows())
+            {
+                setFlag(ItemHasNoContents, !value.toBool());
+                customScene->invalidateBundle(this);
+            }
+        }
     }
-    return QPointF();
+    else if (change == QGraphicsItem::ItemSceneChange)
+    {
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            customScene->unregisterItem(this);
+    }
+    else if (change == QGraphicsItem::ItemSceneHasChanged)
+    {
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            customScene->registerItem(this);
+    }
+    return QGraphicsLineItem::itemChange(change, value);
+}
+
+QPointF Arrow::calculateIntersectionPoint(CustomItem *item, const QLineF &line)
+{
+    QPointF intersectPoint;
+    if (!item->geometry().intersect(line.translated(-item->pos()), &intersectPoint))
+        return QPointF();
+    return intersectPoint + item->pos();
 }
@@ -19,8 +19,11 @@ public:
     enum { Type = UserType + 4 };
 
     Arrow(CustomItem *startItem, CustomItem *endItem,QGraphicsItem *parent = 0);
+    ~Arrow();
 
     int type() const override { return Type; }
+    int id() const { return myId; }
+    void setId(int id);
     QRectF boundingRect() const override;
     QPainterPath shape() const override;
     void setColor(const QColor &color) { myColor = color; }
@@ -29,18 +32,38 @@ public:
     CustomItem *endItem() const { return myEndItem; }
     bool operator==(Arrow &arrow);
 
+    // recomputes the clipped line and the head; paint() only draws them
     void updatePosition();
 
-    QPointF calculateIntersectionPoint(const QPolygonF &polygon, CustomItem *item, const QLineF &line);
+    // The orthogonal route in scene coordinates, clipped to the endpoints.
+    // It holds only while the endpoints stay where they were when it was
+    // set; the arrow is drawn straight while it has none.
+    QPolygonF route() const { return myRoute; }
+    void setRoute(QPolygonF const& route);
+    bool routeCrosses(QRectF const& rect) const;
+    // false while the endpoints overlap and nothing is drawn
+    bool isDrawn() const { return !endpointsOverlap; }
+
+    QPointF calculateIntersectionPoint(CustomItem *item, const QLineF &line);
 protected:
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = 0) override;
+    QVariant itemChange(GraphicsItemChange change, const QVariant &value) override;
 
 private:
     CustomItem *myStartItem;
     CustomItem *myEndItem;
     QColor myColor;
+    int myId;
+
+    QPolygonF clippedRoute(QPolygonF const& route);
 
+    // cached by updatePosition()
     QPolygonF arrowHead;
+    bool endpointsOverlap = false;
+
+    QPolygonF myRoute;
+    QRectF routedFrom;
+    QRectF routedTo;
 };
 
 #endif // ARROW_H
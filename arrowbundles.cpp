@@ -0,0 +1,152 @@
+#include "arrowbundles.h"
+#include "arrow.h"
+#include "levelofdetail.h"
+
+#include <QPainter>
+#include <QtMath>
+
+namespace {
+
+// the pair of cells an arrow's ends fall in
+quint64 cellKey(const QLineF &ends)
+{
+    auto cell = [](qreal value) {
+        return quint64(qBound(0, qFloor(value / ArrowBundles::CellSize) + 0x8000, 0xffff));
+    };
+    return cell(ends.x1()) << 48 | cell(ends.y1()) << 32 | cell(ends.x2()) << 16 | cell(ends.y2());
+}
+
+QLineF arrowEnds(Arrow *arrow)
+{
+    QPolygonF route = arrow->route();
+    return route.isEmpty() ? arrow->line() : QLineF(route.first(), route.last());
+}
+
+}
+
+void ArrowBundles::update(Arrow *arrow)
+{
+    remove(arrow);
+    if (arrow->isSelected() || !arrow->isDrawn())
+        return;
+    quint64 key = cellKey(arrowEnds(arrow));
+    bundles[key].members.append(arrow);
+    arrowKeys.insert(arrow, key);
+    changedKeys.insert(key);
+}
+
+void ArrowBundles::remove(Arrow *arrow)
+{
+    QHash<Arrow*, quint64>::iterator it = arrowKeys.find(arrow);
+    if (it == arrowKeys.end())
+        return;
+    bundles[it.value()].members.removeOne(arrow);
+    changedKeys.insert(it.value());
+    arrowKeys.erase(it);
+}
+
+void ArrowBundles::clear()
+{
+    bundles.clear();
+    arrowKeys.clear();
+    changedKeys.clear();
+}
+
+void ArrowBundles::rebuildChanged(QVector<QRectF> *changed)
+{
+    foreach (quint64 key, changedKeys)
+    {
+        QHash<quint64, Bundle>::iterator it = bundles.find(key);
+        if (it == bundles.end()) continue;
+        if (!it->bounds.isNull())
+            changed->append(it->bounds);
+        if (it->members.isEmpty())
+        {
+            bundles.erase(it);
+            continue;
+        }
+        rebuild(*it);
+        changed->append(it->bounds);
+    }
+    changedKeys.clear();
+}
+
+void ArrowBundles::rebuild(Bundle &bundle) const
+{
+    int count = bundle.members.size();
+    QPointF startSum, endSum;
+    foreach (Arrow *arrow, bundle.members)
+    {
+        QLineF ends = arrowEnds(arrow);
+        startSum += ends.p1();
+        endSum += ends.p2();
+    }
+    QPointF trunkStart = startSum / count;
+    QPointF trunkEnd = endSum / count;
+
+    bundle.strokes.clear();
+    QHash<QRgb, int> byColor;
+    foreach (Arrow *arrow, bundle.members)
+    {
+        QColor color = arrow->getColor();
+        QHash<QRgb, int>::const_iterator it = byColor.constFind(color.rgba());
+        if (it == byColor.constEnd())
+        {
+            it = byColor.insert(color.rgba(), bundle.strokes.size());
+            Stroke stroke;
+            stroke.color = color;
+            if (count > 1)
+            {
+                stroke.path.moveTo(trunkStart);
+                stroke.path.lineTo(trunkEnd);
+            }
+            bundle.strokes.append(stroke);
+        }
+        QPainterPath &path = bundle.strokes[it.value()].path;
+        QLineF ends = arrowEnds(arrow);
+        if (count > 1)
+        {
+            path.moveTo(ends.p1());
+            path.lineTo(trunkStart);
+            path.moveTo(trunkEnd);
+            path.lineTo(ends.p2());
+        }
+        else if (!arrow->route().isEmpty())
+        {
+            path.addPolygon(arrow->route());
+        }
+        else
+        {
+            path.moveTo(ends.p1());
+            path.lineTo(ends.p2());
+        }
+    }
+
+    QRectF bounds;
+    foreach (Stroke const& stroke, bundle.strokes)
+        bounds = bounds.united(stroke.path.controlPointRect());
+    bundle.bounds = bounds.adjusted(-PenWidth, -PenWidth, PenWidth, PenWidth);
+}
+
+void ArrowBundles::draw(QPainter *painter, const QRectF &exposed) const
+{
+    painter->save();
+    painter->setBrush(Qt::NoBrush);
+    // hairlines when zoomed out, as the arrows draw themselves
+    bool hairlines = LevelOfDetail::tier(painter) != LevelOfDetail::Full;
+    if (hairlines)
+        painter->setRenderHint(QPainter::Antialiasing, false);
+    foreach (Bundle const& bundle, bundles)
+    {
+        if (!bundle.bounds.intersects(exposed)) continue;
+        foreach (Stroke const& stroke, bundle.strokes)
+        {
+            if (hairlines)
+                painter->setPen(QPen(stroke.color, 0));
+            else
+                painter->setPen(QPen(stroke.color, PenWidth, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+            painter->drawPath(stroke.path);
+        }
+    }
+    painter->restore();
+}
@@ -0,0 +1,64 @@
+#ifndef ARROWBUNDLES_H
+#define ARROWBUNDLES_H
+
+#include <QColor>
+#include <QHash>
+#include <QPainterPath>
+#include <QRectF>
+#include <QSet>
+#include <QVector>
+
+class Arrow;
+class QPainter;
+
+// Draws many arrows as a few bundles. Arrows whose ends fall in the same
+// pair of cells share a bundle: each runs from its start to the mean start
+// of the bundle, along the shared trunk to the mean end and on to its own
+// end. The arrows of a bundle are collected into one path per color, so a
+// repaint costs a drawPath per bundle and color, however many arrows
+// there are.
+//
+// Bundles are kept by cell pair and only those an arrow left or joined
+// are rebuilt, so a moved arrow costs the arrows of its bundles.
+class ArrowBundles
+{
+public:
+    static const int CellSize = 200;
+    static const int PenWidth = 2;          // as the arrows draw themselves
+
+    // Files the arrow under the cells of its ends, after it moved, changed
+    // or was selected; selected arrows, and those whose ends overlap, are
+    // left out.
+    void update(Arrow *arrow);
+    void remove(Arrow *arrow);
+    void clear();
+
+    // Rebuilds the bundles changed since the last call and adds the areas
+    // to repaint, their old and new bounds, to changed.
+    void rebuildChanged(QVector<QRectF> *changed);
+    int size() const { return bundles.size(); }
+
+    void draw(QPainter *painter, QRectF const& exposed) const;
+
+private:
+    struct Stroke
+    {
+        QColor color;
+        QPainterPath path;
+    };
+
+    struct Bundle
+    {
+        QVector<Arrow*> members;
+        QVector<Stroke> strokes;
+        QRectF bounds;
+    };
+
+    void rebuild(Bundle &bundle) const;
+
+    QHash<quint64, Bundle> bundles;
+    QHash<Arrow*, quint64> arrowKeys;
+    QSet<quint64> changedKeys;
+};
+
+#endif // ARROWBUNDLES_H
@@ -0,0 +1,58 @@
+# Stand-alone benchmarks for the document formats.
+#   qmake benchmarks.pro && make && ./benchmarks [item count]
+
+QT       += core gui widgets xml concurrent
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = benchmarks
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    main.cpp \
+    ../anchorindex.cpp \
+    ../arrow.cpp \
+    ../arrowbundles.cpp \
+    ../binarydocument.cpp \
+    ../compresseddocument.cpp \
+    ../connectorrouter.cpp \
+    ../customitem.cpp \
+    ../custompixmapitem.cpp \
+    ../customscene.cpp \
+    ../customtextitem.cpp \
+    ../customview.cpp \
+    ../documentloader.cpp \
+    ../imagestore.cpp \
+    ../itemstate.cpp \
+    ../levelofdetail.cpp \
+    ../paralleldecode.cpp \
+    ../scenepager.cpp \
+    ../shapegeometry.cpp \
+    ../undojournal.cpp \
+    ../undosystem.cpp \
+    ../xmldocument.cpp
+
+HEADERS += \
+    ../anchorindex.h \
+    ../arrow.h \
+    ../arrowbundles.h \
+    ../binarydocument.h \
+    ../compresseddocument.h \
+    ../connectorrouter.h \
+    ../customitem.h \
+    ../custompixmapitem.h \
+    ../customscene.h \
+    ../customtextitem.h \
+    ../customview.h \
+    ../documentloader.h \
+    ../imagestore.h \
+    ../itemstate.h \
+    ../levelofdetail.h \
+    ../paralleldecode.h \
+    ../scenepager.h \
+    ../shapegeometry.h \
+    ../undojournal.h \
+    ../undosystem.h \
+    ../xmldocument.h
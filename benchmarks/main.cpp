@@ -0,0 +1,413 @@
+#include "anchorindex.h"
+#include "binarydocument.h"
+#include "compresseddocument.h"
+#include "connectorrouter.h"
+#include "customscene.h"
+#include "documentloader.h"
+#include "itemstate.h"
+#include "levelofdetail.h"
+#include "shapegeometry.h"
+#include "xmldocument.h"
+
+#include <QApplication>
+#include <QAtomicInt>
+#include <QBuffer>
+#include <QDir>
+#include <QDomDocument>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QGraphicsRectItem>
+#include <QImage>
+#include <QPainter>
+#include <QPainterPath>
+#include <QTemporaryFile>
+#include <QThread>
+#include <QTextStream>
+#include <QVector>
+#include <cstdio>
+
+// Peak resident set size in KB, -1 where /proc is not available.
+static qint64 peakMemoryKB()
+{
+    QFile status("/proc/self/status");
+    if (!status.open(QIODevice::ReadOnly | QIODevice::Text))
+        return -1;
+    foreach (QByteArray const& line, status.readAll().split('\n'))
+    {
+        if (line.startsWith("VmHWM:"))
+            return line.mid(6).trimmed().split(' ').first().toLongLong();
+    }
+    return -1;
+}
+
+static void report(const char *name, qint64 ms, qint64 bytes, qint64 count)
+{
+    std::printf("%-24s %8lld ms %12lld bytes %10lld items  peak %lld KB\n",
+                name, ms, bytes, count, peakMemoryKB());
+}
+
+// A grid of shapes, each connected to its right neighbour, with a label
+// every tenth shape.
+static QVector<ItemState> makeDocument(int count)
+{
+    QVector<ItemState> states;
+    QPolygonF polygon;
+    polygon << QPointF(-60, -60) << QPointF(60, -60) << QPointF(60, 60)
+            << QPointF(-60, 60) << QPointF(-60, -60);
+    int columns = 200;
+    for (int i = 0; i < count; ++i)
+    {
+        ItemState shape;
+        shape.kind = ItemState::Shape;
+        shape.fields = ItemState::AllFields;
+        shape.id = i;
+        shape.customType = i % 6;
+        shape.pos = QPointF((i % columns) * 150, (i / columns) * 150);
+        shape.polygon = polygon;
+        shape.color = Qt::white;
+        states.append(shape);
+
+        if (i % 10 == 0)
+        {
+            ItemState text;
+            text.kind = ItemState::Text;
+            text.fields = ItemState::AllFields;
+            text.id = count * 2 + i;
+            text.text = QString("Label %1").arg(i);
+            text.pos = shape.pos + QPointF(0, 70);
+            states.append(text);
+        }
+    }
+    for (int i = 0; i + 1 < count; ++i)
+    {
+        ItemState arrow;
+        arrow.kind = ItemState::Connector;
+        arrow.fields = ItemState::AllFields;
+        arrow.id = count + i;
+        arrow.startId = i;
+        arrow.endId = i + 1;
+        arrow.color = Qt::black;
+        states.append(arrow);
+    }
+    return states;
+}
+
+// The DOM path the editor used before the streaming reader/writer.
+static QByteArray writeDom(QVector<ItemState> const& states)
+{
+    QDomDocument doc;
+    QDomElement root = doc.createElement("scene");
+    doc.appendChild(root);
+    QDomElement sceneElement = doc.createElement("Scene");
+    root.appendChild(sceneElement);
+    foreach (ItemState const& state, states)
+    {
+        if (state.kind == ItemState::Shape)
+        {
+            QDomElement element = doc.createElement("CustomItem");
+            element.setAttribute("id", state.id);
+            element.setAttribute("type", state.customType);
+            element.setAttribute("x", state.pos.x());
+            element.setAttribute("y", state.pos.y());
+            QPointF center = state.polygon.boundingRect().center();
+            element.setAttribute("centerX", center.x());
+            element.setAttribute("centerY", center.y());
+            sceneElement.appendChild(element);
+        }
+        else if (state.kind == ItemState::Connector)
+        {
+            QDomElement element = doc.createElement("Arrow");
+            element.setAttribute("id", state.id);
+            element.setAttribute("startItemId", state.startId);
+            element.setAttribute("endItemId", state.endId);
+            element.setAttribute("lineColor", state.color.name());
+            element.setAttribute("intersectX", state.pos.x());
+            element.setAttribute("intersectY", state.pos.y());
+            sceneElement.appendChild(element);
+        }
+        else if (state.kind == ItemState::Text)
+        {
+            QDomElement element = doc.createElement("Text");
+            element.setAttribute("id", state.id);
+            element.setAttribute("Name", state.text);
+            element.setAttribute("x", state.pos.x());
+            element.setAttribute("y", state.pos.y());
+            sceneElement.appendChild(element);
+        }
+    }
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    QTextStream stream(&buffer);
+    stream << doc.toString();
+    stream.flush();
+    return data;
+}
+
+static int readDom(QByteArray const& data)
+{
+    QDomDocument doc;
+    doc.setContent(data);
+    QDomNodeList itemList = doc.documentElement().firstChildElement("Scene").childNodes();
+    int count = 0;
+    for (int i = 0; i < itemList.count(); i++)
+    {
+        QDomElement element = itemList.at(i).toElement();
+        ItemState state;
+        state.id = element.attribute("id").toInt();
+        state.pos = QPointF(element.attribute("x").toDouble(), element.attribute("y").toDouble());
+        count++;
+    }
+    return count;
+}
+
+static QByteArray writeStream(QVector<ItemState> const& states)
+{
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    XmlDocumentWriter writer(&buffer);
+    foreach (ItemState const& state, states)
+        writer.writeItem(state);
+    writer.finish();
+    return data;
+}
+
+static int readStream(QByteArray &data)
+{
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+    XmlDocumentReader reader(&buffer);
+    ItemState state;
+    int count = 0;
+    while (reader.readItem(&state))
+        count++;
+    return count;
+}
+
+static int readBinary(QString const& fileName)
+{
+    BinaryDocument document;
+    if (!document.open(fileName))
+        return 0;
+    int count = 0;
+    for (int i = 0; i < document.shapeCount(); ++i, ++count)
+        document.shapeState(i);
+    for (int i = 0; i < document.textCount(); ++i, ++count)
+        document.textState(i);
+    for (int i = 0; i < document.arrowCount(); ++i, ++count)
+        document.arrowState(i);
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+    int count = argc > 1 ? QString(argv[1]).toInt() : 100000;
+
+    QVector<ItemState> states = makeDocument(count);
+    std::printf("%d shapes, %d items in total\n", count, states.size());
+    QElapsedTimer timer;
+
+    // streaming first: the peak memory column is a high-water mark
+    timer.start();
+    QByteArray streamed = writeStream(states);
+    report("xml stream write", timer.elapsed(), streamed.size(), states.size());
+    timer.start();
+    int streamedCount = readStream(streamed);
+    report("xml stream read", timer.elapsed(), streamed.size(), streamedCount);
+
+    // the loader tells the formats apart by their suffix
+    QTemporaryFile binary(QDir::tempPath() + "/benchmark-XXXXXX.dpd");
+    binary.open();
+    timer.start();
+    BinaryDocument::write(&binary, states);
+    binary.flush();
+    report("binary write", timer.elapsed(), binary.size(), states.size());
+    timer.start();
+    int binaryCount = readBinary(binary.fileName());
+    report("binary read (mmap)", timer.elapsed(), binary.size(), binaryCount);
+
+    // decoding scales with the threads, item creation does not take part
+    for (int threads = 1; threads <= QThread::idealThreadCount(); threads *= 2)
+    {
+        BinaryDocument document;
+        document.open(binary.fileName());
+        QAtomicInt decoded(0);
+        timer.start();
+        document.decode(threads, [&decoded](QVector<ItemState> const& chunk) {
+            decoded.fetchAndAddRelaxed(chunk.size());
+            return true;
+        });
+        QByteArray name = QString("binary decode %1 thr").arg(threads).toLatin1();
+        report(name.constData(), timer.elapsed(), binary.size(), decoded.load());
+    }
+
+    // opening the document in the editor: decoding on the workers and
+    // item creation on this thread, a frame budget at a time
+    for (int threads = 1; threads <= QThread::idealThreadCount(); ++threads)
+    {
+        CustomScene scene(nullptr);
+        DocumentLoader loader(&scene);
+        loader.setThreadCount(threads);
+        QEventLoop loop;
+        QObject::connect(&loader, SIGNAL(finished(QString,bool,QString)), &loop, SLOT(quit()));
+        timer.start();
+        loader.load(binary.fileName(), QPointF());
+        loop.exec();
+        QByteArray name = QString("binary load %1 thr").arg(threads).toLatin1();
+        report(name.constData(), timer.elapsed(), binary.size(), scene.itemCount());
+    }
+
+    // a handful of moved shapes appended to the big file
+    QVector<ItemState> moved;
+    for (int i = 0; i < 10 && i < count; ++i)
+    {
+        ItemState state = states.at(i);
+        state.pos += QPointF(10, 10);
+        moved.append(state);
+    }
+    timer.start();
+    qint64 records = 0;
+    BinaryDocument::append(binary.fileName(), moved, QVector<int>(), &records);
+    report("binary append (10)", timer.elapsed(), QFileInfo(binary.fileName()).size(), moved.size());
+
+    // compressed container: the whole file, then the chunks under one view
+    QTemporaryFile compressed;
+    compressed.open();
+    timer.start();
+    CompressedDocument::write(&compressed, states);
+    compressed.flush();
+    report("dpz write", timer.elapsed(), compressed.size(), states.size());
+    {
+        CompressedDocument document;
+        document.open(compressed.fileName());
+        QVector<int> all;
+        for (int c = 0; c < document.chunkCount(); ++c)
+            all.append(c);
+        QAtomicInt decoded(0);
+        timer.start();
+        document.decode(all, QThread::idealThreadCount(), [&decoded](QVector<ItemState> const& chunk) {
+            decoded.fetchAndAddRelaxed(chunk.size());
+            return true;
+        });
+        qint64 ms = timer.elapsed();
+        report("dpz read all", ms, compressed.size(), decoded.load());
+        std::printf("%-24s %8.1f MB/s inflated-equivalent xml, ratio %.1fx\n", "dpz throughput",
+                    streamed.size() / 1048576.0 / qMax<qint64>(ms, 1) * 1000,
+                    double(streamed.size()) / qMax<qint64>(compressed.size(), 1));
+
+        QVector<int> visible = document.chunksIn(QRectF(0, 0, 1920, 1080));
+        decoded.store(0);
+        timer.start();
+        document.decode(visible, 1, [&decoded](QVector<ItemState> const& chunk) {
+            decoded.fetchAndAddRelaxed(chunk.size());
+            return true;
+        });
+        report("dpz read one view", timer.elapsed(), compressed.size(), decoded.load());
+    }
+
+    // what a drag asks for on every mouse move
+    {
+        QVector<QGraphicsRectItem*> anchors;
+        AnchorIndex index;
+        foreach (ItemState const& state, states)
+        {
+            if (state.kind != ItemState::Shape) continue;
+            anchors.append(new QGraphicsRectItem);
+            index.insert(anchors.last(), state.pos);
+        }
+        QSet<QGraphicsItem*> excluded;
+        int hits = 0;
+        timer.start();
+        for (int i = 0; i < 100000; ++i)
+        {
+            qreal found;
+            QPointF pos = states.at(i % states.size()).pos + QPointF(3, 3);
+            hits += index.nearestX(pos.x(), 5, excluded, &found) ? 1 : 0;
+            hits += index.nearestY(pos.y(), 5, excluded, &found) ? 1 : 0;
+        }
+        report("anchor queries (100k)", timer.elapsed(), 0, hits);
+        qDeleteAll(anchors);
+    }
+
+    // what clipping an arrow against a circle costs, flattened and closed form
+    {
+        QPainterPath path;
+        path.addEllipse(QPointF(0, 0), 50, 50);
+        ShapeGeometry shapes[2] = { ShapeGeometry::outline(path.toFillPolygon()),
+                                    ShapeGeometry::ellipse(QRectF(-50, -50, 100, 100)) };
+        char const *names[2] = { "clip flattened circle (100k)", "clip ellipse (100k)" };
+        for (int k = 0; k < 2; ++k)
+        {
+            int hits = 0;
+            timer.start();
+            for (int i = 0; i < 100000; ++i)
+            {
+                QPointF point;
+                QLineF line(QPointF(0, 0), QLineF::fromPolar(200, i % 360).p2());
+                hits += shapes[k].intersect(line, &point) ? 1 : 0;
+            }
+            report(names[k], timer.elapsed(), 0, hits);
+        }
+    }
+
+    // routing an arrow past the shape between its endpoints
+    {
+        QVector<QRectF> shapes;
+        for (int i = 0; i < 9; ++i)
+            shapes.append(QRectF((i % 3) * 150 - 60, (i / 3) * 150 - 60, 120, 120));
+        int routed = 0;
+        timer.start();
+        for (int i = 0; i < 1000; ++i)
+        {
+            QVector<QRectF> obstacles = shapes;
+            QRectF from = obstacles.takeAt(i % 2 ? 6 : 3);
+            QRectF to = obstacles.takeAt(i % 2 ? 1 : 4);
+            routed += ConnectorRouter::route(from, to, obstacles).isEmpty() ? 0 : 1;
+        }
+        report("route arrows (1k)", timer.elapsed(), 0, routed);
+    }
+
+    // a whole-diagram overview frame, everything drawn in full and by tier
+    {
+        QVector<ItemState> shown;
+        foreach (ItemState const& state, states)
+        {
+            int first = state.kind == ItemState::Connector ? state.endId
+                      : state.kind == ItemState::Text ? state.id - count * 2 : state.id;
+            if (first < 2000)
+                shown.append(state);
+        }
+        CustomScene scene(nullptr);
+        scene.reconcile(shown, QVector<int>());
+        QImage frame(1600, 1000, QImage::Format_ARGB32_Premultiplied);
+        qreal thresholds[2][3] = { { 0, 0, 0 },
+                                   { LevelOfDetail::DefaultSimplified, LevelOfDetail::DefaultSketch, LevelOfDetail::DefaultBoxes } };
+        char const *names[2] = { "paint overview full (10)", "paint overview tiered (10)" };
+        for (int k = 0; k < 2; ++k)
+        {
+            LevelOfDetail::setThresholds(thresholds[k][0], thresholds[k][1], thresholds[k][2]);
+            timer.start();
+            for (int i = 0; i < 10; ++i)
+            {
+                frame.fill(Qt::white);
+                QPainter painter(&frame);
+                painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing);
+                scene.render(&painter, frame.rect(), scene.itemsBoundingRect(), Qt::KeepAspectRatio);
+            }
+            report(names[k], timer.elapsed(), 0, scene.itemCount());
+        }
+    }
+
+    timer.start();
+    QByteArray dom = writeDom(states);
+    report("xml dom write", timer.elapsed(), dom.size(), states.size());
+    timer.start();
+    int domCount = readDom(dom);
+    report("xml dom read", timer.elapsed(), dom.size(), domCount);
+
+    return 0;
+}
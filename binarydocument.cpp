@@ -0,0 +1,723 @@
+#include "binarydocument.h"
+#include "imagestore.h"
+#include "paralleldecode.h"
+
+#include <QDebug>
+#include <QHash>
+#include <QIODevice>
+#include <QObject>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+
+bool isLittleEndian(QString *errorString)
+{
+    if (Q_BYTE_ORDER == Q_LITTLE_ENDIAN)
+        return true;
+    if (errorString)
+        *errorString = QObject::tr("Binary diagrams are only supported on little-endian hosts");
+    return false;
+}
+
+template <typename T>
+void appendRecord(QByteArray &section, T const& record)
+{
+    section.append(reinterpret_cast<const char*>(&record), int(sizeof(T)));
+}
+
+void alignSection(QByteArray &section)
+{
+    while (section.size() % 8 != 0)
+        section.append('\0');
+}
+
+// Deduplicating string table: entries point into one UTF-16 blob.
+class StringTable
+{
+public:
+    qint32 add(QString const& string)
+    {
+        if (string.isEmpty())
+            return -1;
+        QHash<QString, qint32>::const_iterator it = index.constFind(string);
+        if (it != index.constEnd())
+            return it.value();
+
+        BinaryDocument::StringEntry entry;
+        entry.offset = quint32(data.size());
+        entry.length = quint32(string.size());
+        appendRecord(entries, entry);
+        data.append(reinterpret_cast<const char*>(string.utf16()), string.size() * 2);
+
+        qint32 id = index.size();
+        index.insert(string, id);
+        return id;
+    }
+
+    int count() const { return index.size(); }
+    QByteArray section() const
+    {
+        QByteArray bytes = entries + data;
+        alignSection(bytes);
+        return bytes;
+    }
+
+private:
+    QHash<QString, qint32> index;
+    QByteArray entries;
+    QByteArray data;
+};
+
+// Each image the segment refers to, once, by its ImageStore key.
+class PixmapTable
+{
+public:
+    qint32 add(QByteArray const& key)
+    {
+        QHash<QByteArray, qint32>::const_iterator it = index.constFind(key);
+        if (it != index.constEnd())
+            return it.value();
+
+        QByteArray image = ImageStore::encoded(key);
+        BinaryDocument::PixmapEntry entry;
+        std::memset(&entry, 0, sizeof(entry));
+        entry.offset = quint64(data.size());
+        entry.size = quint32(image.size());
+        std::memcpy(entry.key, key.constData(), qMin(key.size(), int(sizeof(entry.key))));
+        appendRecord(entries, entry);
+        data += image;
+        alignSection(data);
+
+        qint32 id = index.size();
+        index.insert(key, id);
+        return id;
+    }
+
+    int count() const { return index.size(); }
+    QByteArray section() const { return entries + data; }
+
+private:
+    QHash<QByteArray, qint32> index;
+    QByteArray entries;
+    QByteArray data;
+};
+
+}
+
+qint64 BinaryDocument::headerSize(quint32 version)
+{
+    // older headers are prefixes of the current one
+    switch (version) {
+    case 1: return offsetof(Header, tombstoneCount);
+    case 2: return offsetof(Header, pixmapItemCount);
+    case 3: return offsetof(Header, routeCount);
+    default: return sizeof(Header);
+    }
+}
+
+QByteArray BinaryDocument::segmentData(const QVector<ItemState> &states, const QVector<int> &removedIds)
+{
+    QByteArray shapeSection, arrowSection, textSection, pixmapItemSection, routeSection, pointSection;
+    StringTable strings;
+    PixmapTable pixmaps;
+    quint32 shapeCount = 0, arrowCount = 0, textCount = 0, pixmapItemCount = 0, pointCount = 0;
+
+    foreach (ItemState const& state, states)
+    {
+        switch (state.kind) {
+        case ItemState::Shape:
+        {
+            ShapeRecord record;
+            std::memset(&record, 0, sizeof(record));
+            record.id = state.id;
+            record.type = state.customType;
+            record.x = state.pos.x();
+            record.y = state.pos.y();
+            record.z = state.z;
+            record.hasBrush = state.color.isValid();
+            record.brush = state.color.isValid() ? state.color.rgba() : 0;
+            record.label = strings.add(state.text);
+            record.firstPoint = pointCount;
+            record.pointCount = quint32(state.polygon.size());
+            foreach (QPointF const& p, state.polygon)
+            {
+                PointRecord point = { p.x(), p.y() };
+                appendRecord(pointSection, point);
+            }
+            pointCount += record.pointCount;
+            appendRecord(shapeSection, record);
+            shapeCount++;
+            break;
+        }
+        case ItemState::Connector:
+        {
+            ArrowRecord record;
+            std::memset(&record, 0, sizeof(record));
+            record.id = state.id;
+            record.startId = state.startId;
+            record.endId = state.endId;
+            record.color = state.color.rgba();
+            record.z = state.z;
+            appendRecord(arrowSection, record);
+            RouteRecord route = { pointCount, quint32(state.polygon.size()) };
+            foreach (QPointF const& p, state.polygon)
+            {
+                PointRecord point = { p.x(), p.y() };
+                appendRecord(pointSection, point);
+            }
+            pointCount += route.pointCount;
+            appendRecord(routeSection, route);
+            arrowCount++;
+            break;
+        }
+        case ItemState::Text:
+        {
+            TextRecord record;
+            std::memset(&record, 0, sizeof(record));
+            record.id = state.id;
+            record.color = state.color.rgba();
+            record.x = state.pos.x();
+            record.y = state.pos.y();
+            record.z = state.z;
+            record.text = strings.add(state.text);
+            record.font = strings.add(state.font.toString());
+            appendRecord(textSection, record);
+            textCount++;
+            break;
+        }
+        case ItemState::Pixmap:
+        {
+            PixmapItemRecord record;
+            std::memset(&record, 0, sizeof(record));
+            record.id = state.id;
+            record.image = pixmaps.add(state.image);
+            record.x = state.pos.x();
+            record.y = state.pos.y();
+            record.z = state.z;
+            appendRecord(pixmapItemSection, record);
+            pixmapItemCount++;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    QByteArray stringSection = strings.section();
+    QByteArray pixmapSection = pixmaps.section();
+
+    QByteArray tombstoneSection;
+    foreach (int id, removedIds)
+        appendRecord(tombstoneSection, qint32(id));
+    alignSection(tombstoneSection);
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "DPDB", 4);
+    header.version = Version;
+    header.shapeCount = shapeCount;
+    header.arrowCount = arrowCount;
+    header.textCount = textCount;
+    header.pointCount = pointCount;
+    header.stringCount = quint32(strings.count());
+    header.pixmapCount = quint32(pixmaps.count());
+    header.pixmapItemCount = pixmapItemCount;
+    header.routeCount = arrowCount;
+    header.tombstoneCount = quint32(removedIds.size());
+    header.shapeOffset = sizeof(Header);
+    header.arrowOffset = header.shapeOffset + shapeSection.size();
+    header.textOffset = header.arrowOffset + arrowSection.size();
+    header.pixmapItemOffset = header.textOffset + textSection.size();
+    header.routeOffset = header.pixmapItemOffset + pixmapItemSection.size();
+    header.pointOffset = header.routeOffset + routeSection.size();
+    header.stringOffset = header.pointOffset + pointSection.size();
+    header.pixmapOffset = header.stringOffset + stringSection.size();
+    header.tombstoneOffset = header.pixmapOffset + pixmapSection.size();
+    header.segmentSize = header.tombstoneOffset + tombstoneSection.size();
+
+    QByteArray bytes;
+    bytes.reserve(int(header.segmentSize));
+    appendRecord(bytes, header);
+    bytes += shapeSection;
+    bytes += arrowSection;
+    bytes += textSection;
+    bytes += pixmapItemSection;
+    bytes += routeSection;
+    bytes += pointSection;
+    bytes += stringSection;
+    bytes += pixmapSection;
+    bytes += tombstoneSection;
+    return bytes;
+}
+
+bool BinaryDocument::write(QIODevice *device, const QVector<ItemState> &states, QString *errorString)
+{
+    if (!isLittleEndian(errorString))
+        return false;
+
+    QByteArray bytes = segmentData(states, QVector<int>());
+    if (device->write(bytes) != bytes.size())
+    {
+        if (errorString)
+            *errorString = device->errorString();
+        return false;
+    }
+    return true;
+}
+
+bool BinaryDocument::append(const QString &fileName, const QVector<ItemState> &states, const QVector<int> &removedIds,
+                            qint64 *recordCount, QString *errorString)
+{
+    if (!isLittleEndian(errorString))
+        return false;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadWrite))
+    {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+
+    qint64 validEnd = 0;
+    quint32 version = 0;
+    qint64 records = scan(&file, &validEnd, &version);
+    if (records < 0 || version != Version)
+    {
+        if (errorString)
+            *errorString = QObject::tr("%1 cannot be saved incrementally").arg(fileName);
+        return false;
+    }
+
+    // drop what an interrupted save may have left behind
+    if (validEnd != file.size() && !file.resize(validEnd))
+    {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+
+    QByteArray bytes = segmentData(states, removedIds);
+    if (!file.seek(validEnd) || file.write(bytes) != bytes.size() || !file.flush())
+    {
+        if (errorString)
+            *errorString = file.errorString();
+        file.resize(validEnd);
+        return false;
+    }
+
+    Header const *header = reinterpret_cast<Header const*>(bytes.constData());
+    records += header->shapeCount + header->arrowCount + header->textCount + header->pixmapItemCount
+            + header->tombstoneCount;
+    if (recordCount)
+        *recordCount = records;
+    return true;
+}
+
+bool BinaryDocument::isAppendable(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    qint64 validEnd = 0;
+    quint32 version = 0;
+    return scan(&file, &validEnd, &version) >= 0 && version == Version;
+}
+
+qint64 BinaryDocument::scan(QIODevice *device, qint64 *validEnd, quint32 *version)
+{
+    // walks the segment headers only; records are not touched
+    qint64 fileSize = device->size();
+    qint64 pos = 0;
+    qint64 records = 0;
+    *validEnd = 0;
+    *version = 0;
+    while (pos + qint64(sizeof(Header)) <= fileSize)
+    {
+        Header header;
+        if (!device->seek(pos) || device->read(reinterpret_cast<char*>(&header), sizeof(Header)) != qint64(sizeof(Header)))
+            break;
+        if (std::memcmp(header.magic, "DPDB", 4) != 0 || header.version != Version)
+            break;
+        if (header.segmentSize < sizeof(Header) || header.segmentSize > quint64(fileSize - pos))
+            break;
+        records += header.shapeCount + header.arrowCount + header.textCount + header.pixmapItemCount
+                + header.tombstoneCount;
+        pos += qint64(header.segmentSize);
+        *validEnd = pos;
+        *version = Version;
+    }
+    if (*version == 0)
+    {
+        // possibly an older, single-segment file
+        Header header;
+        if (device->seek(0) && device->read(reinterpret_cast<char*>(&header), headerSize(1)) == headerSize(1)
+                && std::memcmp(header.magic, "DPDB", 4) == 0)
+        {
+            *version = header.version;
+            *validEnd = fileSize;
+        }
+        return *version == 0 ? -1 : 0;
+    }
+    return records;
+}
+
+bool BinaryDocument::open(const QString &fileName)
+{
+    close();
+    QString error;
+    if (!isLittleEndian(&error))
+        return fail(error);
+
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return fail(file.errorString());
+    size = file.size();
+    if (size < headerSize(1))
+        return fail(QObject::tr("File is truncated"));
+    data = file.map(0, size);
+    if (data == nullptr)
+        return fail(file.errorString());
+
+    qint64 pos = 0;
+    while (pos < size)
+    {
+        Segment segment;
+        if (!readSegment(data + pos, size - pos, &segment, &error))
+        {
+            if (segments.isEmpty())
+                return fail(error);
+            // a torn tail from an interrupted incremental save
+            qDebug() << "ignoring" << size - pos << "bytes at the end of" << fileName << ":" << error;
+            break;
+        }
+        segments.append(segment);
+        pos += segment.size;
+    }
+    resolve();
+    storeImages();
+    return true;
+}
+
+bool BinaryDocument::readSegment(const uchar *data, qint64 available, Segment *segment, QString *errorString)
+{
+    if (available < headerSize(1))
+    {
+        *errorString = QObject::tr("File is truncated");
+        return false;
+    }
+    Header &header = segment->header;
+    std::memset(&header, 0, sizeof(Header));
+    std::memcpy(&header, data, headerSize(1));
+    if (std::memcmp(header.magic, "DPDB", 4) != 0)
+    {
+        *errorString = QObject::tr("Not a binary diagram");
+        return false;
+    }
+    if (header.version < 1 || header.version > Version)
+    {
+        *errorString = QObject::tr("Unsupported binary diagram version %1").arg(header.version);
+        return false;
+    }
+    if (available < headerSize(header.version))
+    {
+        *errorString = QObject::tr("File is truncated");
+        return false;
+    }
+    std::memcpy(&header, data, headerSize(header.version));
+    if (header.version == 1)
+        header.segmentSize = quint64(available);
+    if (header.segmentSize < quint64(headerSize(header.version)) || header.segmentSize > quint64(available)
+            || header.segmentSize % 8 != 0)
+    {
+        *errorString = QObject::tr("File is truncated");
+        return false;
+    }
+
+    quint64 segmentSize = header.segmentSize;
+    auto fits = [segmentSize](quint64 offset, quint64 count, quint64 recordSize) {
+        return offset % 8 == 0 && offset <= segmentSize && count <= (segmentSize - offset) / recordSize;
+    };
+    if (!fits(header.shapeOffset, header.shapeCount, sizeof(ShapeRecord))
+            || !fits(header.arrowOffset, header.arrowCount, sizeof(ArrowRecord))
+            || !fits(header.textOffset, header.textCount, sizeof(TextRecord))
+            || !fits(header.pixmapItemOffset, header.pixmapItemCount, sizeof(PixmapItemRecord))
+            || !fits(header.routeOffset, header.routeCount, sizeof(RouteRecord))
+            || (header.routeCount != 0 && header.routeCount != header.arrowCount)
+            || !fits(header.pointOffset, header.pointCount, sizeof(PointRecord))
+            || !fits(header.stringOffset, header.stringCount, sizeof(StringEntry))
+            || !fits(header.pixmapOffset, header.pixmapCount, sizeof(PixmapEntry))
+            || !fits(header.tombstoneOffset, header.tombstoneCount, sizeof(qint32)))
+    {
+        *errorString = QObject::tr("File is corrupt");
+        return false;
+    }
+
+    segment->size = qint64(segmentSize);
+    segment->shapes = reinterpret_cast<ShapeRecord const*>(data + header.shapeOffset);
+    segment->arrows = reinterpret_cast<ArrowRecord const*>(data + header.arrowOffset);
+    segment->texts = reinterpret_cast<TextRecord const*>(data + header.textOffset);
+    segment->pixmapItems = reinterpret_cast<PixmapItemRecord const*>(data + header.pixmapItemOffset);
+    segment->routes = reinterpret_cast<RouteRecord const*>(data + header.routeOffset);
+    segment->points = reinterpret_cast<PointRecord const*>(data + header.pointOffset);
+    segment->strings = reinterpret_cast<StringEntry const*>(data + header.stringOffset);
+    quint64 stringDataOffset = header.stringOffset + header.stringCount * sizeof(StringEntry);
+    segment->stringData = reinterpret_cast<char const*>(data + stringDataOffset);
+    segment->stringDataSize = qint64(segmentSize - stringDataOffset);
+    segment->pixmaps = reinterpret_cast<PixmapEntry const*>(data + header.pixmapOffset);
+    quint64 pixmapDataOffset = header.pixmapOffset + header.pixmapCount * sizeof(PixmapEntry);
+    segment->pixmapData = data + pixmapDataOffset;
+    segment->pixmapDataSize = qint64(segmentSize - pixmapDataOffset);
+    segment->tombstones = reinterpret_cast<qint32 const*>(data + header.tombstoneOffset);
+    return true;
+}
+
+void BinaryDocument::resolve()
+{
+    // a single segment without tombstones is live as a whole
+    bool layered = segments.size() > 1 || segments.first().header.tombstoneCount > 0;
+    QHash<int, Location> latest;
+    if (layered)
+    {
+        for (int s = 0; s < segments.size(); ++s)
+        {
+            Segment const& segment = segments.at(s);
+            for (quint32 i = 0; i < segment.header.tombstoneCount; ++i)
+                latest.remove(segment.tombstones[i]);
+            for (quint32 i = 0; i < segment.header.shapeCount; ++i)
+                latest.insert(segment.shapes[i].id, Location{ s, ItemState::Shape, int(i) });
+            for (quint32 i = 0; i < segment.header.arrowCount; ++i)
+                latest.insert(segment.arrows[i].id, Location{ s, ItemState::Connector, int(i) });
+            for (quint32 i = 0; i < segment.header.textCount; ++i)
+                latest.insert(segment.texts[i].id, Location{ s, ItemState::Text, int(i) });
+            for (quint32 i = 0; i < segment.header.pixmapItemCount; ++i)
+                latest.insert(segment.pixmapItems[i].id, Location{ s, ItemState::Pixmap, int(i) });
+        }
+    }
+
+    Location none = { -1, ItemState::Invalid, -1 };
+    for (int s = 0; s < segments.size(); ++s)
+    {
+        Segment const& segment = segments.at(s);
+        for (quint32 i = 0; i < segment.header.shapeCount; ++i)
+        {
+            Location location = { s, ItemState::Shape, int(i) };
+            if (!layered || latest.value(segment.shapes[i].id, none) == location)
+                liveShapes.append(location);
+        }
+        for (quint32 i = 0; i < segment.header.arrowCount; ++i)
+        {
+            Location location = { s, ItemState::Connector, int(i) };
+            if (!layered || latest.value(segment.arrows[i].id, none) == location)
+                liveArrows.append(location);
+        }
+        for (quint32 i = 0; i < segment.header.textCount; ++i)
+        {
+            Location location = { s, ItemState::Text, int(i) };
+            if (!layered || latest.value(segment.texts[i].id, none) == location)
+                liveTexts.append(location);
+        }
+        for (quint32 i = 0; i < segment.header.pixmapItemCount; ++i)
+        {
+            Location location = { s, ItemState::Pixmap, int(i) };
+            if (!layered || latest.value(segment.pixmapItems[i].id, none) == location)
+                livePixmapItems.append(location);
+        }
+    }
+}
+
+void BinaryDocument::storeImages() const
+{
+    // copied out of the mapping, so items outlive the open file
+    foreach (Segment const& segment, segments)
+    {
+        for (quint32 i = 0; i < segment.header.pixmapCount; ++i)
+        {
+            PixmapEntry const& entry = segment.pixmaps[i];
+            if (qint64(entry.offset) + qint64(entry.size) > segment.pixmapDataSize)
+                continue;
+            QByteArray key(entry.key, ImageStore::KeySize);
+            if (!ImageStore::contains(key))
+            {
+                ImageStore::insertEncoded(key, QByteArray(reinterpret_cast<const char*>(segment.pixmapData + entry.offset),
+                                                          int(entry.size)));
+            }
+        }
+    }
+}
+
+void BinaryDocument::close()
+{
+    if (data)
+        file.unmap(data);
+    file.close();
+    data = nullptr;
+    size = 0;
+    segments.clear();
+    liveShapes.clear();
+    liveArrows.clear();
+    liveTexts.clear();
+    livePixmapItems.clear();
+}
+
+qint64 BinaryDocument::recordCount() const
+{
+    qint64 count = 0;
+    foreach (Segment const& segment, segments)
+    {
+        count += segment.header.shapeCount + segment.header.arrowCount + segment.header.textCount
+                + segment.header.pixmapItemCount + segment.header.tombstoneCount;
+    }
+    return count;
+}
+
+QPolygonF BinaryDocument::points(const Segment &segment, quint32 first, quint32 count) const
+{
+    QPolygonF polygon;
+    if (quint64(first) + count > segment.header.pointCount)
+        return polygon;
+    polygon.reserve(int(count));
+    PointRecord const *p = segment.points + first;
+    for (quint32 i = 0; i < count; ++i, ++p)
+        polygon.append(QPointF(p->x, p->y));
+    return polygon;
+}
+
+QString BinaryDocument::string(const Segment &segment, qint32 index) const
+{
+    if (index < 0 || quint32(index) >= segment.header.stringCount)
+        return QString();
+    StringEntry const& entry = segment.strings[index];
+    if (qint64(entry.offset) + qint64(entry.length) * 2 > segment.stringDataSize)
+        return QString();
+    return QString(reinterpret_cast<const QChar*>(segment.stringData + entry.offset), int(entry.length));
+}
+
+ItemState BinaryDocument::shapeState(int i) const
+{
+    Segment const& segment = segments.at(liveShapes.at(i).segment);
+    ShapeRecord const& record = segment.shapes[liveShapes.at(i).index];
+    ItemState state;
+    state.kind = ItemState::Shape;
+    state.fields = ItemState::AllFields;
+    state.id = record.id;
+    state.customType = record.type;
+    state.pos = QPointF(record.x, record.y);
+    state.z = record.z;
+    state.polygon = points(segment, record.firstPoint, record.pointCount);
+    if (record.hasBrush)
+        state.color = QColor::fromRgba(record.brush);
+    state.text = string(segment, record.label);
+    return state;
+}
+
+ItemState BinaryDocument::arrowState(int i) const
+{
+    Segment const& segment = segments.at(liveArrows.at(i).segment);
+    int index = liveArrows.at(i).index;
+    ArrowRecord const& record = segment.arrows[index];
+    ItemState state;
+    state.kind = ItemState::Connector;
+    state.fields = ItemState::AllFields;
+    state.id = record.id;
+    state.startId = record.startId;
+    state.endId = record.endId;
+    state.color = QColor::fromRgba(record.color);
+    state.z = record.z;
+    if (quint32(index) < segment.header.routeCount)
+        state.polygon = points(segment, segment.routes[index].firstPoint, segment.routes[index].pointCount);
+    return state;
+}
+
+ItemState BinaryDocument::textState(int i) const
+{
+    Segment const& segment = segments.at(liveTexts.at(i).segment);
+    TextRecord const& record = segment.texts[liveTexts.at(i).index];
+    ItemState state;
+    state.kind = ItemState::Text;
+    state.fields = ItemState::AllFields;
+    state.id = record.id;
+    state.pos = QPointF(record.x, record.y);
+    state.z = record.z;
+    state.color = QColor::fromRgba(record.color);
+    state.text = string(segment, record.text);
+    state.font.fromString(string(segment, record.font));
+    return state;
+}
+
+ItemState BinaryDocument::pixmapItemState(int i) const
+{
+    Segment const& segment = segments.at(livePixmapItems.at(i).segment);
+    PixmapItemRecord const& record = segment.pixmapItems[livePixmapItems.at(i).index];
+    ItemState state;
+    state.kind = ItemState::Pixmap;
+    state.fields = ItemState::AllFields;
+    state.id = record.id;
+    state.pos = QPointF(record.x, record.y);
+    state.z = record.z;
+    if (record.image >= 0 && quint32(record.image) < segment.header.pixmapCount)
+        state.image = QByteArray(segment.pixmaps[record.image].key, ImageStore::KeySize);
+    return state;
+}
+
+QVector<ItemState> BinaryDocument::states() const
+{
+    // shapes and texts before the arrows that refer to them
+    QVector<ItemState> result;
+    result.reserve(liveCount());
+    for (int i = 0; i < shapeCount(); ++i)
+        result.append(shapeState(i));
+    for (int i = 0; i < textCount(); ++i)
+        result.append(textState(i));
+    for (int i = 0; i < pixmapItemCount(); ++i)
+        result.append(pixmapItemState(i));
+    for (int i = 0; i < arrowCount(); ++i)
+        result.append(arrowState(i));
+    return result;
+}
+
+void BinaryDocument::decode(int threadCount, const std::function<bool(const QVector<ItemState>&)> &sink) const
+{
+    // records are fixed-size, so any index range decodes on its own
+    struct Range
+    {
+        int kind;
+        int from;
+        int to;
+    };
+    QVector<Range> ranges;
+    auto split = [&ranges](int kind, int count) {
+        for (int from = 0; from < count; from += DecodeChunk)
+            ranges.append(Range{ kind, from, qMin(count, from + DecodeChunk) });
+    };
+    split(ItemState::Shape, shapeCount());
+    split(ItemState::Text, textCount());
+    split(ItemState::Pixmap, pixmapItemCount());
+    split(ItemState::Connector, arrowCount());
+
+    decodeInParallel(ranges.size(), threadCount, [&](int r) {
+        Range const& range = ranges.at(r);
+        QVector<ItemState> states;
+        states.reserve(range.to - range.from);
+        for (int i = range.from; i < range.to; ++i)
+        {
+            if (range.kind == ItemState::Shape)
+                states.append(shapeState(i));
+            else if (range.kind == ItemState::Text)
+                states.append(textState(i));
+            else if (range.kind == ItemState::Pixmap)
+                states.append(pixmapItemState(i));
+            else
+                states.append(arrowState(i));
+        }
+        return sink(states);
+    });
+}
+
+bool BinaryDocument::fail(const QString &message)
+{
+    myErrorString = message;
+    close();
+    return false;
+}
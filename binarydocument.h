@@ -0,0 +1,239 @@
+#ifndef BINARYDOCUMENT_H
+#define BINARYDOCUMENT_H
+
+#include "itemstate.h"
+
+#include <QFile>
+#include <QVector>
+#include <cstddef>
+#include <functional>
+
+class QIODevice;
+
+// Versioned binary diagram format (".dpd"). A file is a chain of segments.
+// Each segment has a fixed header followed by fixed-layout record tables
+// for shapes, arrows, texts and pixmap items, a route table with one entry
+// per arrow record, a point table holding the shape polygons and arrow
+// routes, a string table, a pixmap table holding each image the
+// segment refers to once (PNG, keyed by its ImageStore hash) and a
+// tombstone table of removed ids.
+// All tables are 8-byte aligned and little-endian, so the reader maps the
+// file and reads records in place without any parsing.
+//
+// A full save writes a single segment. An incremental save appends a
+// segment with the changed items and tombstones for the removed ones; a
+// record overrides any earlier record with the same id, a tombstone
+// removes it. Version 1 files are a single segment without tombstones,
+// version 2 segments have no pixmap items and version 3 segments have no
+// routes.
+class BinaryDocument
+{
+public:
+    struct Header
+    {
+        char magic[4];
+        quint32 version;
+        quint32 shapeCount;
+        quint32 arrowCount;
+        quint32 textCount;
+        quint32 pointCount;
+        quint32 stringCount;
+        quint32 pixmapCount;
+        quint64 shapeOffset;
+        quint64 arrowOffset;
+        quint64 textOffset;
+        quint64 pointOffset;
+        quint64 stringOffset;
+        quint64 pixmapOffset;
+        // version 2
+        quint32 tombstoneCount;
+        quint32 reserved;
+        quint64 tombstoneOffset;
+        quint64 segmentSize;
+        // version 3
+        quint32 pixmapItemCount;
+        quint32 reserved2;
+        quint64 pixmapItemOffset;
+        // version 4
+        quint32 routeCount;
+        quint32 reserved3;
+        quint64 routeOffset;
+    };
+
+    struct ShapeRecord
+    {
+        qint32 id;
+        qint32 type;
+        double x;
+        double y;
+        double z;
+        quint32 brush;
+        quint32 hasBrush;
+        qint32 label;
+        quint32 firstPoint;
+        quint32 pointCount;
+        quint32 reserved;
+    };
+
+    struct ArrowRecord
+    {
+        qint32 id;
+        qint32 startId;
+        qint32 endId;
+        quint32 color;
+        double z;
+    };
+
+    struct TextRecord
+    {
+        qint32 id;
+        quint32 color;
+        double x;
+        double y;
+        double z;
+        qint32 text;
+        qint32 font;
+    };
+
+    struct PixmapItemRecord
+    {
+        qint32 id;
+        qint32 image;
+        double x;
+        double y;
+        double z;
+    };
+
+    // the route of the arrow record with the same index
+    struct RouteRecord
+    {
+        quint32 firstPoint;
+        quint32 pointCount;
+    };
+
+    struct PointRecord
+    {
+        double x;
+        double y;
+    };
+
+    struct StringEntry
+    {
+        quint32 offset;
+        quint32 length;
+    };
+
+    // offset counts from the end of the entry table
+    struct PixmapEntry
+    {
+        quint64 offset;
+        quint32 size;
+        quint32 reserved;
+        char key[24];
+    };
+
+    static const quint32 Version = 4;
+    static const int DecodeChunk = 4096;
+
+    static bool write(QIODevice *device, QVector<ItemState> const& states, QString *errorString = nullptr);
+    static bool append(const QString &fileName, QVector<ItemState> const& states, QVector<int> const& removedIds,
+                       qint64 *recordCount = nullptr, QString *errorString = nullptr);
+    static bool isAppendable(const QString &fileName);
+
+    bool open(QString const& fileName);
+    void close();
+    QString errorString() const { return myErrorString; }
+
+    int shapeCount() const { return liveShapes.size(); }
+    int arrowCount() const { return liveArrows.size(); }
+    int textCount() const { return liveTexts.size(); }
+    int pixmapItemCount() const { return livePixmapItems.size(); }
+    int liveCount() const { return shapeCount() + arrowCount() + textCount() + pixmapItemCount(); }
+    qint64 recordCount() const;
+    int segmentCount() const { return segments.size(); }
+
+    ItemState shapeState(int i) const;
+    ItemState arrowState(int i) const;
+    ItemState textState(int i) const;
+    ItemState pixmapItemState(int i) const;
+    QVector<ItemState> states() const;
+
+    // Decodes the live records on up to threadCount threads, handing them
+    // to sink in chunks as they are done; sink is called from any of those
+    // threads and stops the decoding by returning false.
+    void decode(int threadCount, std::function<bool(QVector<ItemState> const&)> const& sink) const;
+
+private:
+    struct Segment
+    {
+        Header header;
+        qint64 size;
+        ShapeRecord const *shapes;
+        ArrowRecord const *arrows;
+        TextRecord const *texts;
+        PixmapItemRecord const *pixmapItems;
+        RouteRecord const *routes;
+        PointRecord const *points;
+        StringEntry const *strings;
+        char const *stringData;
+        qint64 stringDataSize;
+        qint32 const *tombstones;
+        PixmapEntry const *pixmaps;
+        uchar const *pixmapData;
+        qint64 pixmapDataSize;
+    };
+
+    struct Location
+    {
+        int segment;
+        int kind;
+        int index;
+        bool operator==(Location const& other) const
+        {
+            return segment == other.segment && kind == other.kind && index == other.index;
+        }
+    };
+
+    static QByteArray segmentData(QVector<ItemState> const& states, QVector<int> const& removedIds);
+    static bool readSegment(uchar const *data, qint64 available, Segment *segment, QString *errorString);
+    static qint64 scan(QIODevice *device, qint64 *validEnd, quint32 *version);
+    static qint64 headerSize(quint32 version);
+
+    void resolve();
+    void storeImages() const;
+    QPolygonF points(Segment const& segment, quint32 first, quint32 count) const;
+    QString string(Segment const& segment, qint32 index) const;
+    bool fail(QString const& message);
+
+    QFile file;
+    uchar *data = nullptr;
+    qint64 size = 0;
+    QVector<Segment> segments;
+    QVector<Location> liveShapes;
+    QVector<Location> liveArrows;
+    QVector<Location> liveTexts;
+    QVector<Location> livePixmapItems;
+    QString myErrorString;
+};
+
+// Records are read in place from the mapping: their layout is the file's,
+// and no table entry may need more than the 8-byte alignment of its table.
+static_assert(sizeof(BinaryDocument::Header) == 136, "header layout");
+static_assert(offsetof(BinaryDocument::Header, tombstoneCount) == 80, "version 1 header size");
+static_assert(offsetof(BinaryDocument::Header, pixmapItemCount) == 104, "version 2 header size");
+static_assert(offsetof(BinaryDocument::Header, routeCount) == 120, "version 3 header size");
+static_assert(sizeof(BinaryDocument::ShapeRecord) == 56, "shape record layout");
+static_assert(sizeof(BinaryDocument::ArrowRecord) == 24, "arrow record layout");
+static_assert(sizeof(BinaryDocument::TextRecord) == 40, "text record layout");
+static_assert(sizeof(BinaryDocument::PixmapItemRecord) == 32, "pixmap item record layout");
+static_assert(sizeof(BinaryDocument::RouteRecord) == 8, "route record layout");
+static_assert(sizeof(BinaryDocument::PointRecord) == 16, "point record layout");
+static_assert(sizeof(BinaryDocument::StringEntry) == 8, "string entry layout");
+static_assert(sizeof(BinaryDocument::PixmapEntry) == 40, "pixmap entry layout");
+static_assert(alignof(BinaryDocument::Header) <= 8 && alignof(BinaryDocument::ShapeRecord) <= 8
+              && alignof(BinaryDocument::ArrowRecord) <= 8 && alignof(BinaryDocument::TextRecord) <= 8
+              && alignof(BinaryDocument::PixmapItemRecord) <= 8 && alignof(BinaryDocument::RouteRecord) <= 8
+              && alignof(BinaryDocument::PointRecord) <= 8 && alignof(BinaryDocument::StringEntry) <= 8
+              && alignof(BinaryDocument::PixmapEntry) <= 8, "records must fit the 8-byte table alignment");
+
+#endif // BINARYDOCUMENT_H
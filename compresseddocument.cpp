@@ -0,0 +1,367 @@
+#include "compresseddocument.h"
+#include "imagestore.h"
+#include "paralleldecode.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QHash>
+#include <QIODevice>
+#include <QObject>
+#include <QSet>
+#include <QtConcurrent>
+#include <QtEndian>
+#include <algorithm>
+
+namespace {
+
+const char Magic[4] = { 'D', 'P', 'D', 'Z' };
+const qint64 HeaderSize = 56;
+const int CellSize = 512;
+
+// position along a Z-order curve over 512px cells, so items close in the
+// scene end up in the same chunk
+quint64 zOrder(const QPointF &pos)
+{
+    quint32 x = quint32(qBound(0, int(pos.x() / CellSize) + 0x8000, 0xffff));
+    quint32 y = quint32(qBound(0, int(pos.y() / CellSize) + 0x8000, 0xffff));
+    quint64 key = 0;
+    for (int bit = 0; bit < 16; ++bit)
+    {
+        key |= quint64((x >> bit) & 1) << (2 * bit);
+        key |= quint64((y >> bit) & 1) << (2 * bit + 1);
+    }
+    return key;
+}
+
+// an arrow is filed at the middle of its endpoints and covers both, and
+// its route if it has one
+QPointF itemAnchor(const ItemState &state, const QHash<int, QPointF> &positions)
+{
+    if (state.kind == ItemState::Connector)
+        return (positions.value(state.startId) + positions.value(state.endId)) / 2;
+    return state.pos;
+}
+
+QRectF itemBounds(const ItemState &state, const QHash<int, QPointF> &positions)
+{
+    if (state.kind == ItemState::Shape && !state.polygon.isEmpty())
+        return state.polygon.boundingRect().translated(state.pos);
+    if (state.kind == ItemState::Connector)
+    {
+        QRectF span = QRectF(positions.value(state.startId), positions.value(state.endId)).normalized();
+        if (!state.polygon.isEmpty())
+            span = span.united(state.polygon.boundingRect());
+        return span.adjusted(0, 0, 1, 1);
+    }
+    // not a null rect, so that it survives united()
+    return QRectF(state.pos, QSizeF(1, 1));
+}
+
+QByteArray compressChunk(const QVector<ItemState> &states)
+{
+    QByteArray raw;
+    QDataStream out(&raw, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << qint32(states.size());
+    foreach (ItemState const& state, states)
+        out << state;
+    return qCompress(raw);
+}
+
+}
+
+bool CompressedDocument::write(QIODevice *device, const QVector<ItemState> &states, QString *errorString)
+{
+    QHash<int, QPointF> positions;
+    foreach (ItemState const& state, states)
+    {
+        if (state.kind != ItemState::Connector)
+            positions.insert(state.id, state.pos);
+    }
+
+    QVector<QPair<quint64, int> > order;
+    order.reserve(states.size());
+    for (int i = 0; i < states.size(); ++i)
+        order.append(qMakePair(zOrder(itemAnchor(states.at(i), positions)), i));
+    std::sort(order.begin(), order.end());
+
+    QVector<QVector<ItemState> > rawChunks;
+    QVector<QRectF> bounds;
+    QVector<qint32> ids;
+    QVector<quint32> idChunks;
+    QSet<QByteArray> imageKeys;
+    for (int i = 0; i < order.size(); ++i)
+    {
+        if (i % ChunkItems == 0)
+        {
+            rawChunks.append(QVector<ItemState>());
+            rawChunks.last().reserve(ChunkItems);
+            bounds.append(QRectF());
+        }
+        ItemState const& state = states.at(order.at(i).second);
+        rawChunks.last().append(state);
+        bounds.last() = bounds.last().united(itemBounds(state, positions));
+        ids.append(state.id);
+        idChunks.append(quint32(rawChunks.size() - 1));
+        if (state.kind == ItemState::Pixmap)
+            imageKeys.insert(state.image);
+    }
+
+    // chunks are independent, so they compress in parallel
+    QVector<QByteArray> compressed = QtConcurrent::blockingMapped<QVector<QByteArray> >(rawChunks, compressChunk);
+
+    QByteArray images;
+    {
+        QDataStream out(&images, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_6);
+        out << qint32(imageKeys.size());
+        foreach (QByteArray const& key, imageKeys)
+            out << key << ImageStore::encoded(key);
+    }
+    images = qCompress(images);
+
+    // sorted by id, for lookups by binary search
+    QVector<QPair<qint32, quint32> > idPairs;
+    idPairs.reserve(ids.size());
+    for (int i = 0; i < ids.size(); ++i)
+        idPairs.append(qMakePair(ids.at(i), idChunks.at(i)));
+    std::sort(idPairs.begin(), idPairs.end());
+    QByteArray idMap;
+    {
+        QDataStream out(&idMap, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_6);
+        out << qint32(idPairs.size());
+        for (int i = 0; i < idPairs.size(); ++i)
+            out << idPairs.at(i).first << idPairs.at(i).second;
+    }
+    idMap = qCompress(idMap);
+
+    quint64 offset = HeaderSize;
+    QByteArray index;
+    {
+        QDataStream out(&index, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_6);
+        for (int c = 0; c < compressed.size(); ++c)
+        {
+            QRectF const& rect = bounds.at(c);
+            out << offset << quint32(compressed.at(c).size()) << quint32(rawChunks.at(c).size())
+                << rect.left() << rect.top() << rect.width() << rect.height();
+            offset += compressed.at(c).size();
+        }
+    }
+    quint64 imagesOffset = offset;
+    quint64 idMapOffset = imagesOffset + images.size();
+    quint64 indexOffset = idMapOffset + idMap.size();
+
+    QByteArray header;
+    {
+        QDataStream out(&header, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_6);
+        out.writeRawData(Magic, sizeof(Magic));
+        out << Version << quint32(compressed.size()) << quint32(states.size()) << indexOffset
+            << imagesOffset << quint64(images.size()) << idMapOffset << quint64(idMap.size());
+    }
+
+    QList<QByteArray> parts;
+    parts << header;
+    foreach (QByteArray const& chunk, compressed)
+        parts << chunk;
+    parts << images << idMap << index;
+    foreach (QByteArray const& part, parts)
+    {
+        if (device->write(part) != part.size())
+        {
+            if (errorString)
+                *errorString = device->errorString();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CompressedDocument::open(const QString &fileName)
+{
+    close();
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return fail(file.errorString());
+    size = file.size();
+    if (size < HeaderSize)
+        return fail(QObject::tr("File is truncated"));
+    data = file.map(0, size);
+    if (data == nullptr)
+        return fail(file.errorString());
+
+    QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(data), int(size));
+    QDataStream in(bytes);
+    in.setVersion(QDataStream::Qt_5_6);
+    char magic[4];
+    quint32 version, chunkCount, itemCount;
+    quint64 indexOffset, imagesOffset, imagesSize;
+    in.readRawData(magic, sizeof(magic));
+    in >> version >> chunkCount >> itemCount >> indexOffset >> imagesOffset >> imagesSize >> idMapOffset >> idMapSize;
+    if (memcmp(magic, Magic, sizeof(Magic)) != 0)
+        return fail(QObject::tr("Not a compressed diagram"));
+    if (version != Version)
+        return fail(QObject::tr("Unsupported compressed diagram version %1").arg(version));
+    if (indexOffset > quint64(size) || chunkCount > (quint64(size) - indexOffset) / 48)
+        return fail(QObject::tr("File is corrupt"));
+
+    myItemCount = int(itemCount);
+    in.device()->seek(qint64(indexOffset));
+    chunks.reserve(int(chunkCount));
+    quint64 indexedItems = 0;
+    for (quint32 c = 0; c < chunkCount; ++c)
+    {
+        Chunk chunk;
+        qreal left, top, width, height;
+        in >> chunk.offset >> chunk.size >> chunk.itemCount >> left >> top >> width >> height;
+        chunk.bounds = QRectF(left, top, width, height);
+        if (in.status() != QDataStream::Ok || chunk.offset < quint64(HeaderSize) || chunk.size < 4
+                || chunk.offset + chunk.size > indexOffset
+                || chunk.itemCount == 0 || chunk.itemCount > quint32(ChunkItems))
+            return fail(QObject::tr("File is corrupt"));
+        // qCompress puts the inflated size first; every record takes at
+        // least a byte after the count, and zlib inflates no more than
+        // MaxInflation times
+        chunk.inflatedSize = qFromBigEndian<quint32>(data + chunk.offset);
+        if (chunk.inflatedSize < 4 + chunk.itemCount
+                || chunk.inflatedSize > quint64(chunk.size) * MaxInflation)
+            return fail(QObject::tr("File is corrupt"));
+        indexedItems += chunk.itemCount;
+        chunks.append(chunk);
+    }
+    if (indexedItems != itemCount)
+        return fail(QObject::tr("File is corrupt"));
+    if (!loadIdMap())
+        return fail(QObject::tr("File is corrupt"));
+
+    // images are few and small next to the items, take them all now
+    QByteArray images = block(data, size, imagesOffset, imagesSize);
+    QDataStream imageStream(images);
+    imageStream.setVersion(QDataStream::Qt_5_6);
+    qint32 imageCount = 0;
+    imageStream >> imageCount;
+    for (qint32 i = 0; i < imageCount && imageStream.status() == QDataStream::Ok; ++i)
+    {
+        QByteArray key, image;
+        imageStream >> key >> image;
+        if (!ImageStore::insertEncoded(key, image))
+            return fail(QObject::tr("File is corrupt"));
+        myImageKeys.append(key);
+    }
+    return true;
+}
+
+void CompressedDocument::close()
+{
+    if (data)
+        file.unmap(data);
+    file.close();
+    data = nullptr;
+    size = 0;
+    myItemCount = 0;
+    chunks.clear();
+    idMapOffset = idMapSize = 0;
+    mapIds.clear();
+    mapChunks.clear();
+    myImageKeys.clear();
+}
+
+QByteArray CompressedDocument::block(const uchar *data, qint64 size, quint64 offset, quint64 length)
+{
+    if (offset > quint64(size) || length > quint64(size) - offset)
+        return QByteArray();
+    return qUncompress(data + offset, int(length));
+}
+
+QVector<int> CompressedDocument::chunksIn(const QRectF &region) const
+{
+    QVector<int> result;
+    for (int c = 0; c < chunks.size(); ++c)
+    {
+        if (chunks.at(c).bounds.intersects(region))
+            result.append(c);
+    }
+    return result;
+}
+
+bool CompressedDocument::loadIdMap()
+{
+    QByteArray map = block(data, size, idMapOffset, idMapSize);
+    QDataStream in(map);
+    in.setVersion(QDataStream::Qt_5_6);
+    qint32 count = 0;
+    in >> count;
+    if (in.status() != QDataStream::Ok || count != myItemCount)
+        return false;
+    mapIds.reserve(count);
+    mapChunks.reserve(count);
+    for (qint32 i = 0; i < count; ++i)
+    {
+        qint32 id;
+        quint32 chunk;
+        in >> id >> chunk;
+        // sorted, for the binary searches
+        if (in.status() != QDataStream::Ok || chunk >= quint32(chunks.size())
+                || (!mapIds.isEmpty() && id <= mapIds.last()))
+            return false;
+        mapIds.append(id);
+        mapChunks.append(chunk);
+    }
+    return true;
+}
+
+QVector<int> CompressedDocument::chunksFor(const QVector<int> &ids) const
+{
+    QSet<int> found;
+    foreach (int id, ids)
+    {
+        QVector<qint32>::const_iterator it = std::lower_bound(mapIds.constBegin(), mapIds.constEnd(), id);
+        if (it != mapIds.constEnd() && *it == id)
+            found.insert(int(mapChunks.at(int(it - mapIds.constBegin()))));
+    }
+    QVector<int> result = found.toList().toVector();
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+QVector<ItemState> CompressedDocument::readChunk(int chunk) const
+{
+    Chunk const& entry = chunks.at(chunk);
+    QByteArray raw = block(data, size, entry.offset, entry.size);
+    QDataStream in(raw);
+    in.setVersion(QDataStream::Qt_5_6);
+    qint32 count = 0;
+    in >> count;
+    QVector<ItemState> states;
+    // a chunk that is not what the index says is not read at all
+    if (raw.size() != int(entry.inflatedSize) || count != qint32(entry.itemCount))
+    {
+        qDebug() << "chunk" << chunk << "of" << file.fileName() << "is corrupt";
+        return states;
+    }
+    states.reserve(count);
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+    {
+        ItemState state;
+        in >> state;
+        states.append(state);
+    }
+    return states;
+}
+
+void CompressedDocument::decode(const QVector<int> &order, int threadCount,
+                                const std::function<bool(const QVector<ItemState>&)> &sink) const
+{
+    decodeInParallel(order.size(), threadCount, [&](int i) {
+        return sink(readChunk(order.at(i)));
+    });
+}
+
+bool CompressedDocument::fail(const QString &message)
+{
+    myErrorString = message;
+    close();
+    return false;
+}
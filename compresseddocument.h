@@ -0,0 +1,84 @@
+#ifndef COMPRESSEDDOCUMENT_H
+#define COMPRESSEDDOCUMENT_H
+
+#include "itemstate.h"
+
+#include <QFile>
+#include <QRectF>
+#include <QVector>
+#include <functional>
+
+class QIODevice;
+
+// Chunk-compressed diagram container (".dpz"). Items are sorted along a
+// Z-order curve over the scene, cut into chunks of ChunkItems, serialized
+// as ItemStates and compressed chunk by chunk with qCompress. An arrow is
+// filed at the middle of its endpoints and its chunk covers both of them.
+// An index at the end of the file gives each chunk's offset and bounding
+// rectangle, and a separately compressed id map tells which chunk holds
+// which item, so a region or a set of items can be read without inflating
+// the rest. Both are read and checked when the file is opened, so the
+// queries below do no I/O.
+// Images used by pixmap items are kept once, in their own block.
+//
+//   header | chunk ... | images | id map | index
+class CompressedDocument
+{
+public:
+    static const quint32 Version = 1;
+    static const int ChunkItems = 2048;
+
+    static bool write(QIODevice *device, QVector<ItemState> const& states, QString *errorString = nullptr);
+
+    bool open(const QString &fileName);
+    void close();
+    QString errorString() const { return myErrorString; }
+    QString fileName() const { return file.fileName(); }
+
+    int chunkCount() const { return chunks.size(); }
+    int itemCount() const { return myItemCount; }
+    QRectF chunkBounds(int chunk) const { return chunks.at(chunk).bounds; }
+    // the images the items use, already in the ImageStore
+    QVector<QByteArray> imageKeys() const { return myImageKeys; }
+
+    QVector<int> chunksIn(const QRectF &region) const;
+    QVector<int> chunksFor(QVector<int> const& ids) const;
+    int maxId() const { return mapIds.isEmpty() ? -1 : mapIds.last(); }
+    QVector<ItemState> readChunk(int chunk) const;
+
+    // Inflates the given chunks in order on up to threadCount threads and
+    // hands each to sink, from any of those threads; sink stops the
+    // decoding by returning false.
+    void decode(QVector<int> const& order, int threadCount,
+                std::function<bool(QVector<ItemState> const&)> const& sink) const;
+
+private:
+    struct Chunk
+    {
+        quint64 offset;
+        quint32 size;
+        quint32 itemCount;
+        quint32 inflatedSize;
+        QRectF bounds;
+    };
+
+    static const int MaxInflation = 1032;   // zlib's best case
+
+    static QByteArray block(uchar const *data, qint64 size, quint64 offset, quint64 length);
+    bool loadIdMap();
+    bool fail(QString const& message);
+
+    QFile file;
+    uchar *data = nullptr;
+    qint64 size = 0;
+    int myItemCount = 0;
+    QVector<Chunk> chunks;
+    quint64 idMapOffset = 0;
+    quint64 idMapSize = 0;
+    QVector<qint32> mapIds;        // sorted
+    QVector<quint32> mapChunks;
+    QVector<QByteArray> myImageKeys;
+    QString myErrorString;
+};
+
+#endif // COMPRESSEDDOCUMENT_H
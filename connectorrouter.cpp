@@ -0,0 +1,282 @@
+#include "connectorrouter.h"
+#include "arrow.h"
+#include "customitem.h"
+#include "customscene.h"
+
+#include <QtConcurrent>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+
+namespace {
+
+// directions of travel, so that a turn can be charged for
+enum { East, West, South, North };
+
+int coordinateIndex(QVector<qreal> const& values, qreal value)
+{
+    return int(std::lower_bound(values.constBegin(), values.constEnd(), value) - values.constBegin());
+}
+
+void sortUnique(QVector<qreal> &values)
+{
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+}
+
+}
+
+ConnectorRouter::ConnectorRouter(CustomScene *scene)
+    : QObject(scene), myScene(scene)
+{
+    // the arrows asked for in one pass go into one batch
+    batchTimer.setSingleShot(true);
+    batchTimer.setInterval(0);
+    connect(&batchTimer, SIGNAL(timeout()), this, SLOT(startBatch()));
+    connect(&watcher, SIGNAL(finished()), this, SLOT(batchFinished()));
+}
+
+ConnectorRouter::~ConnectorRouter()
+{
+    watcher.waitForFinished();
+}
+
+void ConnectorRouter::reroute(Arrow *arrow)
+{
+    pending.insert(arrow->id());
+    if (!watcher.isRunning() && !batchTimer.isActive())
+        batchTimer.start();
+}
+
+ConnectorRouter::Job ConnectorRouter::makeJob(Arrow *arrow) const
+{
+    Job job;
+    job.id = arrow->id();
+    job.from = arrow->startItem()->sceneBoundingRect();
+    job.to = arrow->endItem()->sceneBoundingRect();
+
+    // the shapes around both endpoints, only the nearest if there are many
+    QRectF area = job.from.united(job.to).adjusted(-SearchMargin, -SearchMargin, SearchMargin, SearchMargin);
+    QVector<QPair<qreal, QRectF> > nearby;
+    foreach (QGraphicsItem *item, myScene->items(area))
+    {
+        if (item->type() != CustomItem::Type || item == arrow->startItem() || item == arrow->endItem())
+            continue;
+        CustomItem *shape = qgraphicsitem_cast<CustomItem*>(item);
+        job.generations.insert(shape->id(), shape->generation());
+        QRectF rect = item->sceneBoundingRect();
+        QPointF offset = rect.center() - area.center();
+        nearby.append(qMakePair(offset.x() * offset.x() + offset.y() * offset.y(), rect));
+    }
+    if (nearby.size() > MaxObstacles)
+    {
+        std::nth_element(nearby.begin(), nearby.begin() + MaxObstacles, nearby.end(),
+                         [](QPair<qreal, QRectF> const& a, QPair<qreal, QRectF> const& b) { return a.first < b.first; });
+        nearby.resize(MaxObstacles);
+    }
+    job.obstacles.reserve(nearby.size());
+    for (int i = 0; i < nearby.size(); ++i)
+        job.obstacles.append(nearby.at(i).second);
+    return job;
+}
+
+void ConnectorRouter::startBatch()
+{
+    if (watcher.isRunning())
+        return;
+
+    QVector<Job> jobs;
+    QSet<int>::iterator it = pending.begin();
+    while (it != pending.end() && jobs.size() < MaxBatch)
+    {
+        Arrow *arrow = qgraphicsitem_cast<Arrow*>(myScene->itemById(*it));
+        it = pending.erase(it);
+        // overlapping endpoints are not connected by a line at all
+        if (arrow && !arrow->startItem()->collidesWithItem(arrow->endItem()))
+            jobs.append(makeJob(arrow));
+    }
+    if (jobs.isEmpty())
+        return;
+    watcher.setFuture(QtConcurrent::run(&ConnectorRouter::runJobs, jobs));
+}
+
+QVector<ConnectorRouter::Job> ConnectorRouter::runJobs(QVector<Job> jobs)
+{
+    for (int i = 0; i < jobs.size(); ++i)
+        jobs[i].route = route(jobs.at(i).from, jobs.at(i).to, jobs.at(i).obstacles);
+    return jobs;
+}
+
+void ConnectorRouter::batchFinished()
+{
+    foreach (Job const& job, watcher.result())
+    {
+        Arrow *arrow = qgraphicsitem_cast<Arrow*>(myScene->itemById(job.id));
+        if (arrow == nullptr || job.route.isEmpty()) continue;
+        // an endpoint that moved meanwhile has asked again
+        if (arrow->startItem()->sceneBoundingRect() != job.from || arrow->endItem()->sceneBoundingRect() != job.to)
+            continue;
+        if (!isCurrent(arrow, job))
+        {
+            reroute(arrow);
+            continue;
+        }
+        // the same route again is no change to the document
+        QPolygonF before = arrow->route();
+        arrow->setRoute(job.route);
+        if (arrow->route() != before)
+            emit arrowRouted(arrow);
+    }
+    if (!pending.isEmpty())
+        startBatch();
+}
+
+bool ConnectorRouter::isCurrent(Arrow *arrow, const Job &job) const
+{
+    // the shapes along the route, which is orthogonal, segment by segment
+    for (int i = 1; i < job.route.size(); ++i)
+    {
+        QRectF segment = QRectF(job.route.at(i - 1), job.route.at(i)).normalized().adjusted(-0.5, -0.5, 0.5, 0.5);
+        foreach (QGraphicsItem *item, myScene->items(segment))
+        {
+            CustomItem *shape = qgraphicsitem_cast<CustomItem*>(item);
+            if (shape == nullptr || shape == arrow->startItem() || shape == arrow->endItem())
+                continue;
+            QHash<int, quint32>::const_iterator known = job.generations.constFind(shape->id());
+            if (known == job.generations.constEnd() || known.value() != shape->generation())
+                return false;
+        }
+    }
+    return true;
+}
+
+QPolygonF ConnectorRouter::route(const QRectF &from, const QRectF &to, const QVector<QRectF> &obstacles)
+{
+    QPointF start = from.center();
+    QPointF goal = to.center();
+
+    // the graph: lines through both endpoints and along the inflated sides
+    // of the endpoints and of the obstacles
+    QVector<qreal> xs, ys;
+    xs << start.x() << goal.x();
+    ys << start.y() << goal.y();
+    QRectF ends[2] = { from, to };
+    for (QRectF const& rect : ends)
+    {
+        QRectF r = rect.adjusted(-Margin, -Margin, Margin, Margin);
+        xs << r.left() << r.right();
+        ys << r.top() << r.bottom();
+    }
+    QVector<QRectF> blocks;
+    foreach (QRectF const& obstacle, obstacles)
+    {
+        QRectF r = obstacle.adjusted(-Margin, -Margin, Margin, Margin);
+        if (r.contains(start) || r.contains(goal)) continue;
+        blocks.append(r);
+        xs << r.left() << r.right();
+        ys << r.top() << r.bottom();
+    }
+    sortUnique(xs);
+    sortUnique(ys);
+
+    int nx = xs.size();
+    int ny = ys.size();
+    auto node = [ny](int i, int j) { return i * ny + j; };
+    // a node, the edge to its east and the edge to its south
+    QVector<char> blocked(nx * ny, 0), eastBlocked(nx * ny, 0), southBlocked(nx * ny, 0);
+    foreach (QRectF const& r, blocks)
+    {
+        int x0 = coordinateIndex(xs, r.left()), x1 = coordinateIndex(xs, r.right());
+        int y0 = coordinateIndex(ys, r.top()), y1 = coordinateIndex(ys, r.bottom());
+        for (int i = x0; i <= x1; ++i)
+        {
+            for (int j = y0; j <= y1; ++j)
+            {
+                bool insideX = i > x0 && i < x1;
+                bool insideY = j > y0 && j < y1;
+                if (insideX && insideY)
+                    blocked[node(i, j)] = 1;
+                if (i < x1 && insideY)
+                    eastBlocked[node(i, j)] = 1;
+                if (j < y1 && insideX)
+                    southBlocked[node(i, j)] = 1;
+            }
+        }
+    }
+
+    int startNode = node(coordinateIndex(xs, start.x()), coordinateIndex(ys, start.y()));
+    int goalNode = node(coordinateIndex(xs, goal.x()), coordinateIndex(ys, goal.y()));
+    auto heuristic = [&](int n) {
+        return qAbs(xs.at(n / ny) - goal.x()) + qAbs(ys.at(n % ny) - goal.y());
+    };
+
+    // A* over (node, direction of arrival); leaving the start is free in
+    // any direction
+    int stateCount = nx * ny * 4;
+    QVector<qreal> cost(stateCount, std::numeric_limits<qreal>::max());
+    QVector<int> previous(stateCount, -1);
+    QVector<char> closed(stateCount, 0);
+    typedef QPair<qreal, int> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > open;
+    for (int d = 0; d < 4; ++d)
+    {
+        cost[startNode * 4 + d] = 0;
+        open.push(qMakePair(heuristic(startNode), startNode * 4 + d));
+    }
+
+    int found = -1;
+    while (!open.empty())
+    {
+        int state = open.top().second;
+        open.pop();
+        if (closed.at(state)) continue;
+        closed[state] = 1;
+        int n = state / 4;
+        if (n == goalNode)
+        {
+            found = state;
+            break;
+        }
+        int i = n / ny, j = n % ny;
+        for (int d = 0; d < 4; ++d)
+        {
+            int m;
+            if (d == East && i + 1 < nx && !eastBlocked.at(n)) m = node(i + 1, j);
+            else if (d == West && i > 0 && !eastBlocked.at(node(i - 1, j))) m = node(i - 1, j);
+            else if (d == South && j + 1 < ny && !southBlocked.at(n)) m = node(i, j + 1);
+            else if (d == North && j > 0 && !southBlocked.at(node(i, j - 1))) m = node(i, j - 1);
+            else continue;
+            if (blocked.at(m)) continue;
+
+            qreal step = qAbs(xs.at(m / ny) - xs.at(i)) + qAbs(ys.at(m % ny) - ys.at(j));
+            qreal next = cost.at(state) + step + (d != state % 4 ? BendPenalty : 0);
+            int target = m * 4 + d;
+            if (next < cost.at(target))
+            {
+                cost[target] = next;
+                previous[target] = state;
+                open.push(qMakePair(next + heuristic(m), target));
+            }
+        }
+    }
+    if (found < 0)
+        return QPolygonF();
+
+    // back to the start, keeping only the corners
+    QPolygonF points;
+    for (int state = found; state >= 0; state = previous.at(state))
+    {
+        QPointF point(xs.at(state / 4 / ny), ys.at(state / 4 % ny));
+        if (points.size() >= 2)
+        {
+            QPointF a = points.at(points.size() - 2), b = points.last();
+            if ((a.x() == b.x() && b.x() == point.x()) || (a.y() == b.y() && b.y() == point.y()))
+                points.removeLast();
+        }
+        if (points.isEmpty() || points.last() != point)
+            points.append(point);
+    }
+    std::reverse(points.begin(), points.end());
+    return points.size() >= 2 ? points : QPolygonF();
+}
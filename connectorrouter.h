@@ -0,0 +1,76 @@
+#ifndef CONNECTORROUTER_H
+#define CONNECTORROUTER_H
+
+#include <QFutureWatcher>
+#include <QHash>
+#include <QObject>
+#include <QPolygonF>
+#include <QRectF>
+#include <QSet>
+#include <QTimer>
+#include <QVector>
+
+class Arrow;
+class CustomScene;
+
+// Routes arrows orthogonally around the shapes near them. The search is A*
+// over a sparse visibility graph: the grid of lines along the sides of the
+// obstacles, inflated by Margin, and through both endpoints, without the
+// nodes and edges that lie inside an obstacle. Bends cost extra, so routes
+// prefer few of them.
+//
+// Obstacles are collected on the GUI thread, the searches run on a worker
+// thread one batch at a time, and a route is only applied if its endpoints
+// have not moved since it was asked for; a moved endpoint asks again. Nor
+// is one applied across a shape that moved or changed meanwhile, as told
+// by its generation; that arrow is asked for again here.
+class ConnectorRouter : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int Margin = 10;           // clearance around shapes
+    static const int SearchMargin = 300;    // how far beyond the endpoints shapes count
+    static const int MaxObstacles = 64;
+    static const int BendPenalty = 40;
+    static const int MaxBatch = 256;
+
+    explicit ConnectorRouter(CustomScene *scene);
+    ~ConnectorRouter();
+
+    // queues the arrow; it keeps its current route or line until then
+    void reroute(Arrow *arrow);
+
+    // From the center of one rect to the center of the other, in scene
+    // coordinates; empty if the obstacles leave no way through.
+    static QPolygonF route(QRectF const& from, QRectF const& to, QVector<QRectF> const& obstacles);
+
+signals:
+    void arrowRouted(Arrow *arrow);
+
+private slots:
+    void startBatch();
+    void batchFinished();
+
+private:
+    struct Job
+    {
+        int id;
+        QRectF from;
+        QRectF to;
+        QVector<QRectF> obstacles;
+        QHash<int, quint32> generations;    // shapes in the search area
+        QPolygonF route;
+    };
+
+    Job makeJob(Arrow *arrow) const;
+    bool isCurrent(Arrow *arrow, Job const& job) const;
+    static QVector<Job> runJobs(QVector<Job> jobs);
+
+    CustomScene *myScene;
+    QSet<int> pending;
+    QTimer batchTimer;
+    QFutureWatcher<QVector<Job> > watcher;
+};
+
+#endif // CONNECTORROUTER_H
@@ -1,5 +1,8 @@
 #include "customitem.h"
 #include "arrow.h"
+#include "customscene.h"
+#include "itemstate.h"
+#include "levelofdetail.h"
 
 #include <QGraphicsScene>
 #include <QGraphicsSceneContextMenuEvent>
@@ -10,7 +13,26 @@
 #include <QInputDialog>
 #include <QMessageBox>
 
-int CustomItem::idCounter = 0;
+namespace {
+
+// A shape's label; zoomed out it is drawn as bars or not at all.
+class ShapeLabel : public QGraphicsTextItem
+{
+public:
+    ShapeLabel(QString const& text, QGraphicsItem *parent)
+        : QGraphicsTextItem(text, parent)
+    {
+    }
+
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override
+    {
+        if (!LevelOfDetail::drawTextPlaceholder(this, painter))
+            QGraphicsTextItem::paint(painter, option, widget);
+    }
+};
+
+}
+
 double CustomItem::rectangleArea = 0;
 double CustomItem::rectanglePerimeter = 0;
 double CustomItem::circleArea = 0;
@@ -23,74 +45,143 @@ CustomItem::CustomItem(CustomType customType, QMenu *contextMenu, QGraphicsItem
 {
     myCustomType = customType;
     myContextMenu = contextMenu;
-    myId = idCounter++;
-    QPainterPath path;
+    myId = ItemState::allocateId();
+    textItem = nullptr;
     QPixmap pixmap;
     switch (myCustomType) {
     case Output:
-        path.moveTo(200, 50);
-        path.arcTo(150, 0, 50, 50, 0, 90);
-        path.arcTo(50, 0, 50, 50, 90, 90);
-        path.arcTo(50, 50, 50, 50, 180, 90);
-        path.arcTo(150, 50, 50, 50, 270, 90);
-        path.lineTo(200, 50);
-        myPolygon = path.toFillPolygon().translated(-125, -50);
-        textItem = new QGraphicsTextItem("Result :", this);
+        myPolygon = QPolygonF(QRectF(-75, -50, 150, 100));
+        textItem = new ShapeLabel("Result :", this);
         textItem->setPos(-40, -20);
-        setPolygon(myPolygon);
         break;
     case Diamond:
-        myPolygon << QPointF(-75, 0) << QPointF(0, 75)
-                  << QPointF(75, 0) << QPointF(0, -75)
-                  << QPointF(-75, 0);
-        textItem = new QGraphicsTextItem("Diamond", this);
+        myPolygon = QPolygonF(QRectF(-75, -75, 150, 150));
+        textItem = new ShapeLabel("Diamond", this);
         textItem->setPos(-30, -10);
-        setPolygon(myPolygon);
         break;
     case Rectangle:
         myPolygon << QPointF(-60, -60) << QPointF(60, -60)
                   << QPointF(60, 60) << QPointF(-60, 60)
                   << QPointF(-60, -60);
-        textItem = new QGraphicsTextItem("Length : \nWidth :", this);
+        textItem = new ShapeLabel("Length : \nWidth :", this);
         textItem->setPos(-40, -40);
-        setPolygon(myPolygon);
         break;
     case Triangle:
         myPolygon << QPointF(0, -75) << QPointF(65, 65)
                   << QPointF(-65, 65) << QPointF(0, -75);
 
-        textItem = new QGraphicsTextItem("Base :\nAltitude :\nHypotenuse :\nHeight :", this);
+        textItem = new ShapeLabel("Base :\nAltitude :\nHypotenuse :\nHeight :", this);
         textItem->setPos(-40, 10);
-        setPolygon(myPolygon);
         break;
     case Circle:
-        path.addEllipse(QPointF(0, 0), 50, 50);
-        myPolygon = path.toFillPolygon();
-        textItem = new QGraphicsTextItem("Radius : ", this);
+        myPolygon = QPolygonF(QRectF(-50, -50, 100, 100));
+        textItem = new ShapeLabel("Radius : ", this);
         textItem->setPos(-20, -10);
-        setPolygon(myPolygon);
         break;
 
     default:
         myPolygon << QPointF(-60, -40) << QPointF(-35, 40)
                   << QPointF(60, 40) << QPointF(35, -40)
                   << QPointF(-60, -40);
-        setPolygon(myPolygon);
         break;
     }
+    updateGeometry();
 
     setFlag(QGraphicsItem::ItemIsMovable, true);
     setFlag(QGraphicsItem::ItemIsSelectable, true);
     setFlag(QGraphicsItem::ItemSendsGeometryChanges, true);
+    // moves of a group it is in move its anchor too
+    setFlag(QGraphicsItem::ItemSendsScenePositionChanges, true);
     setAcceptHoverEvents(true);
 }
 
+CustomItem::~CustomItem()
+{
+    if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+        customScene->unregisterItem(this);
+}
+
+void CustomItem::setId(int id)
+{
+    myId = id;
+    ItemState::reserveId(id);
+}
+
+void CustomItem::setShapePolygon(const QPolygonF& polygon)
+{
+    myPolygon = polygon;
+    updateGeometry();
+    if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+        customScene->scheduleArrowUpdates(this);
+}
+
+void CustomItem::updateGeometry()
+{
+    // Round shapes are stored as their box and described analytically
+    // within it; the others keep their polygon as the outline.
+    ++myGeneration;
+    QRectF box = myPolygon.boundingRect();
+    switch (myCustomType) {
+    case Circle:
+        myGeometry = ShapeGeometry::ellipse(box);
+        break;
+    case Output:
+        myGeometry = ShapeGeometry::roundedRect(box, box.width() / 6, box.height() / 4);
+        break;
+    case Diamond:
+        myGeometry = ShapeGeometry::regularPolygon(box, 4);
+        break;
+    default:
+        myGeometry = ShapeGeometry::outline(myPolygon);
+        break;
+    }
+    if (myGeometry.isAnalytic())
+        myPolygon = QPolygonF(box);
+    setPolygon(myPolygon);
+}
+
+QPainterPath CustomItem::shape() const
+{
+    if (!myGeometry.isAnalytic())
+        return QGraphicsPolygonItem::shape();
+    return myGeometry.path();
+}
+
+bool CustomItem::contains(const QPointF &point) const
+{
+    if (!myGeometry.isAnalytic())
+        return QGraphicsPolygonItem::contains(point);
+    return myGeometry.contains(point);
+}
+
 void CustomItem::setMainLabelText(const QString &text)
 {
     if (textItem)
         textItem->setPlainText(text);
 }
 
+QString CustomItem::mainLabelText() const
+{
+    return textItem ? textItem->toPlainText() : QString();
+}
+
+void CustomItem::setLabel(const QString &text, const QPointF &pos)
+{
+    if (!textItem) return;
+    textItem->setPos(pos);
+    CustomScene *customScene = qobject_cast<CustomScene*>(scene());
+    if (!customScene)
+    {
+        textItem->setPlainText(text);
+        return;
+    }
+    // recorded like any other edit, so undo and the incremental saves see it
+    QVector<ItemState> before;
+    before.append(ItemState::capture(this, ItemState::Content));
+    textItem->setPlainText(text);
+    customScene->pushCommand(customScene->changeCommand(UndoCommand::TextEdit, before));
+}
+
 void CustomItem::removeArrow(Arrow *arrow)
 {
     int index = arrows.indexOf(arrow);
@@ -122,7 +213,7 @@ QPixmap CustomItem::image() const
     QPainter painter(&pixmap);
     painter.setPen(QPen(Qt::black, 8));
     painter.translate(125, 125);
-    painter.drawPolyline(myPolygon);
+    myGeometry.draw(&painter);
 
     return pixmap;
 }
@@ -150,7 +241,7 @@ CustomItem* CustomItem::clone()
     CustomItem* cloned = new CustomItem(myCustomType, myContextMenu, nullptr);
     cloned->myPolygon = myPolygon;
     cloned->setPos(scenePos());
-    cloned->setPolygon(myPolygon);
+    cloned->updateGeometry();
     cloned->setBrush(brush());
     cloned->setZValue(zValue());
     return cloned;
@@ -169,8 +260,7 @@ void CustomItem::setRectangleProperty()
     rectangleArea = length * width;
     rectanglePerimeter = 2 * (length + width);
 
-    textItem->setPlainText("Length : " + QString::number(length) + "\nWidth : " + QString::number(width));
-    textItem->setPos(-40,-40);
+    setLabel("Length : " + QString::number(length) + "\nWidth : " + QString::number(width), QPointF(-40, -40));
 
     qDebug() << "Rectangle Property" << length << " " << width << rectangleArea << rectanglePerimeter;
 }
@@ -181,8 +271,7 @@ void CustomItem::setCircleProperty()
     double radius = QInputDialog::getDouble(nullptr, "Enter Circle Radius:", "Radius:", 0, 0, 10000, 2, &ok);
     if (!ok) return;
 
-    textItem->setPlainText("Radius : " + QString::number(radius));
-    textItem->setPos(-20,-10);
+    setLabel("Radius : " + QString::number(radius), QPointF(-20, -10));
     circleArea = 3.14 * radius * radius;
     circleCircumference = 2 * 3.14 * radius;
 
@@ -208,9 +297,8 @@ void CustomItem::setTriangleProperty()
     triangleArea = (base * height) / 2;
     trianglePerimeter = altitude + base + hypotenuse;
 
-    textItem->setPlainText("Base : "+QString::number(base)+"\nAltitude : "+QString::number(altitude)+""
-                                                                                                     "\nHypotenuse :"+QString::number(hypotenuse)+"\nHeight : " + QString::number(height));
-    textItem->setPos(-40,-10);
+    setLabel("Base : "+QString::number(base)+"\nAltitude : "+QString::number(altitude)+""
+             "\nHypotenuse :"+QString::number(hypotenuse)+"\nHeight : " + QString::number(height), QPointF(-40, -10));
 
     qDebug() << "Triangle Property " << base << " " << height << " " << triangleArea << " " << trianglePerimeter;
 }
@@ -274,8 +362,13 @@ void CustomItem::mouseMoveEvent(QGraphicsSceneMouseEvent* event)
     if (resizeMode)
     {
         prepareGeometryChange();
-        myPolygon = scaledPolygon(myPolygon, scaleDirection, event->pos());
-        setPolygon(myPolygon);
+        QPointF handle = event->pos();
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            handle = mapFromScene(customScene->snapToGrid(event->scenePos()));
+        myPolygon = scaledPolygon(myPolygon, scaleDirection, handle);
+        updateGeometry();
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            customScene->scheduleArrowUpdates(this);
     }
     QGraphicsItem::mouseMoveEvent(event);
 }
@@ -291,19 +384,10 @@ void CustomItem::mouseReleaseEvent(QGraphicsSceneMouseEvent* event)
     if (resizeMode)
     {
         qDebug() << "after resizing";
-        if (polygon() != previousPolygon)
-        {
-            isResized = true;
-        }
     }
     else
     {
         qDebug() << "\tend moving in" << scenePos();
-        if (scenePos() != movingStartPosition)
-        {
-            isMoved = true;
-            qDebug() << "-- " << scenePos() << movingStartPosition;
-        }
     }
     resizeMode = false;
     QGraphicsItem::mouseReleaseEvent(event);
@@ -336,12 +420,46 @@ void CustomItem::hoverMoveEvent(QGraphicsSceneHoverEvent* event)
 
 void CustomItem::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget)
 {
+    LevelOfDetail::Tier detail = LevelOfDetail::tier(painter);
+    if (detail == LevelOfDetail::Boxes)
+    {
+        // an unfilled shape shows as a box of its outline color
+        if (brush().style() == Qt::NoBrush)
+            painter->fillRect(myGeometry.boundingRect(), pen().color());
+        else
+            painter->fillRect(myGeometry.boundingRect(), brush());
+        return;
+    }
+    if (detail != LevelOfDetail::Full)
+    {
+        painter->setRenderHint(QPainter::Antialiasing, false);
+        if (detail == LevelOfDetail::Sketch)
+        {
+            QPen outline = pen();
+            outline.setWidth(0);
+            painter->setPen(outline);
+            painter->setBrush(brush());
+            myGeometry.draw(painter);
+            return;
+        }
+    }
+
     QStyleOptionGraphicsItem myOption(*option);
     myOption.state &= ~QStyle::State_Selected;
-    QGraphicsPolygonItem::paint(painter, &myOption, widget);
+    if (myGeometry.isAnalytic())
+    {
+        // the paint engine flattens the curves at the device resolution
+        painter->setPen(pen());
+        painter->setBrush(brush());
+        myGeometry.draw(painter);
+    }
+    else
+    {
+        QGraphicsPolygonItem::paint(painter, &myOption, widget);
+    }
 
-    // add resize handles
-    if (this->isSelected())
+    // add resize handles, too small to grab when zoomed out
+    if (this->isSelected() && detail == LevelOfDetail::Full)
     {
         qreal width = resizeHandlePointWidth;
         foreach(QPointF const& point, resizeHandlePoints())
@@ -362,10 +480,42 @@ QVariant CustomItem::itemChange(GraphicsItemChange change, const QVariant &value
 {
     if (change == QGraphicsItem::ItemPositionChange)
     {
-        foreach (Arrow *arrow, arrows)
+        CustomScene *customScene = qobject_cast<CustomScene*>(scene());
+        if (customScene)
         {
-            arrow->updatePosition();
+            customScene->scheduleArrowUpdates(this);
+            // a move by the user
+            if (customScene->isBatchingMoves())
+                return customScene->snapToGrid(value.toPointF());
         }
+        else
+        {
+            foreach (Arrow *arrow, arrows)
+            {
+                arrow->updatePosition();
+            }
+        }
+    }
+    else if (change == QGraphicsItem::ItemScenePositionHasChanged)
+    {
+        ++myGeneration;
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            customScene->anchorMoved(this);
+    }
+    else if (change == QGraphicsItem::ItemSelectedHasChanged)
+    {
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            customScene->itemSelectionChanged(this, value.toBool());
+    }
+    else if (change == QGraphicsItem::ItemSceneChange)
+    {
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            customScene->unregisterItem(this);
+    }
+    else if (change == QGraphicsItem::ItemSceneHasChanged)
+    {
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            customScene->registerItem(this);
     }
     return QGraphicsPolygonItem::itemChange(change, value);
 }
@@ -502,21 +652,18 @@ void CustomItem::performArithmeticOperation() {
             if (startItem->myCustomType == Rectangle && endItem->myCustomType == Output)
             {
                 qDebug() << "Rectangle Property" << rectangleArea << " " << rectanglePerimeter;
-                textItem->setPlainText("Area : " + QString::number(rectangleArea) + "\nPerimeter : " + QString::number(rectanglePerimeter));
-                textItem->setPos(-40, -20);
+                setLabel("Area : " + QString::number(rectangleArea) + "\nPerimeter : " + QString::number(rectanglePerimeter), QPointF(-40, -20));
 
             }
             else if (startItem->myCustomType == Triangle && endItem->myCustomType == Output)
             {
                 qDebug() << "Triangle Property" << triangleArea << " " << trianglePerimeter;
-                textItem->setPlainText("Area : " + QString::number(triangleArea) + "\nPerimeter : " + QString::number(trianglePerimeter));
-                textItem->setPos(-40, -20);
+                setLabel("Area : " + QString::number(triangleArea) + "\nPerimeter : " + QString::number(trianglePerimeter), QPointF(-40, -20));
             }
             else if (startItem->myCustomType == Circle && endItem->myCustomType == Output)
             {
                 qDebug() << "Circle Property" << circleArea << " " << circleCircumference;
-                textItem->setPlainText("Area : " + QString::number(circleArea) + "\nPerimeter : " + QString::number(circleCircumference));
-                textItem->setPos(-40, -20);
+                setLabel("Area : " + QString::number(circleArea) + "\nPerimeter : " + QString::number(circleCircumference), QPointF(-40, -20));
             }
             else if (startItem->myCustomType == Diamond && endItem->myCustomType == Output)
             {
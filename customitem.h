@@ -15,12 +15,12 @@
 #include <QWidget>
 #include <QPolygonF>
 #include "customtextitem.h"
+#include "shapegeometry.h"
 
 class Arrow;
 
 class CustomItem : public QGraphicsPolygonItem
 {
-    friend class CustomView;
 public:
     enum { Type = UserType + 15 };
 
@@ -29,15 +29,21 @@ public:
     enum Direction {TopLeft = 0, Top, TopRight, Left, Right, BottomLeft, Bottom, BottomRight };
 
     CustomItem(CustomType customType, QMenu *contextMenu, QGraphicsItem *parent = nullptr);
+    ~CustomItem();
     QString title;
     void removeArrow(Arrow *arrow);
     void removeArrows();
 
     int id() const { return myId; }
-    void setId(int id) { myId = id; }
+    void setId(int id);
     CustomType customType() const { return myCustomType; }
 
     QPolygonF polygon() const { return myPolygon; }
+    void setShapePolygon(QPolygonF const& polygon);
+    // the outline; round shapes keep only their box in polygon()
+    ShapeGeometry const& geometry() const { return myGeometry; }
+    // changes whenever the shape moves or changes its outline
+    quint32 generation() const { return myGeneration; }
 
     void addArrow(Arrow *arrow);
     QList<Arrow*> getArrows() const { return arrows; }
@@ -45,6 +51,8 @@ public:
     QPixmap image() const;
 
     int type() const override { return Type;}
+    QPainterPath shape() const override;
+    bool contains(QPointF const& point) const override;
 
     QList<QPointF> resizeHandlePoints();
     bool isCloseEnough(QPointF const& p1, QPointF const& p2);
@@ -64,6 +72,7 @@ public:
     static double trianglePerimeter;
 
     void setMainLabelText(const QString &text);
+    QString mainLabelText() const;
     void setPixmap(const QPixmap &pixmap);
 protected:
     void mousePressEvent(QGraphicsSceneMouseEvent *event) override;
@@ -79,23 +88,24 @@ protected:
 
 private:
     QPolygonF scaledPolygon(QPolygonF const& old, Direction direction, QPointF const& newPos);
+    void updateGeometry();
+    void setLabel(QString const& text, QPointF const& pos);
 
     QGraphicsTextItem *textItem;
     CustomType myCustomType;
     QMenu *myContextMenu;
     int myId;
+    quint32 myGeneration = 0;
     QList<Arrow *> arrows;
-    static int idCounter;
     QPolygonF myPolygon;
+    ShapeGeometry myGeometry;
     static constexpr qreal resizeHandlePointWidth = 5;
     static constexpr qreal closeEnoughDistance = 5;
     bool resizeMode = false;
     Direction scaleDirection;
 
     QPointF movingStartPosition;
-    bool isMoved = false;
     QPolygonF previousPolygon;
-    bool isResized = false;
     QString  operation;
 
     bool areConnectedToConditionalItems();
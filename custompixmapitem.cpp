@@ -0,0 +1,61 @@
+#include "custompixmapitem.h"
+#include "customscene.h"
+#include "imagestore.h"
+#include "itemstate.h"
+
+CustomPixmapItem::CustomPixmapItem(const QByteArray &imageKey, QGraphicsItem *parent)
+    : QGraphicsPixmapItem(parent)
+{
+    myId = ItemState::allocateId();
+    setImageKey(imageKey);
+    setFlag(QGraphicsItem::ItemIsMovable, true);
+    setFlag(QGraphicsItem::ItemIsSelectable, true);
+    setFlag(QGraphicsItem::ItemSendsGeometryChanges, true);
+}
+
+CustomPixmapItem::~CustomPixmapItem()
+{
+    if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+        customScene->unregisterItem(this);
+    ImageStore::release(myImageKey);
+}
+
+void CustomPixmapItem::setId(int id)
+{
+    myId = id;
+    ItemState::reserveId(id);
+}
+
+void CustomPixmapItem::setImageKey(const QByteArray &key)
+{
+    ImageStore::retain(key);
+    ImageStore::release(myImageKey);
+    myImageKey = key;
+    setPixmap(ImageStore::pixmap(key));
+}
+
+QVariant CustomPixmapItem::itemChange(GraphicsItemChange change, const QVariant &value)
+{
+    if (change == QGraphicsItem::ItemPositionChange)
+    {
+        CustomScene *customScene = qobject_cast<CustomScene*>(scene());
+        if (customScene && customScene->isBatchingMoves())
+            return customScene->snapToGrid(value.toPointF());
+    }
+    else if (change == QGraphicsItem::ItemSelectedHasChanged)
+    {
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            customScene->itemSelectionChanged(this, value.toBool());
+    }
+    else if (change == QGraphicsItem::ItemSceneChange)
+    {
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            customScene->unregisterItem(this);
+    }
+    else if (change == QGraphicsItem::ItemSceneHasChanged)
+    {
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            customScene->registerItem(this);
+    }
+    return QGraphicsPixmapItem::itemChange(change, value);
+}
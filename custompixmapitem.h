@@ -0,0 +1,31 @@
+#ifndef CUSTOMPIXMAPITEM_H
+#define CUSTOMPIXMAPITEM_H
+
+#include <QByteArray>
+#include <QGraphicsPixmapItem>
+
+// Dropped image (e.g. a tractor sprite). The pixmap itself lives in the
+// ImageStore; the item only keeps its key.
+class CustomPixmapItem : public QGraphicsPixmapItem
+{
+public:
+    enum { Type = UserType + 5 };
+
+    explicit CustomPixmapItem(const QByteArray &imageKey, QGraphicsItem *parent = nullptr);
+    ~CustomPixmapItem();
+
+    int type() const override { return Type; }
+    int id() const { return myId; }
+    void setId(int id);
+    QByteArray imageKey() const { return myImageKey; }
+    void setImageKey(const QByteArray &key);
+
+protected:
+    QVariant itemChange(GraphicsItemChange change, const QVariant &value) override;
+
+private:
+    int myId;
+    QByteArray myImageKey;
+};
+
+#endif // CUSTOMPIXMAPITEM_H
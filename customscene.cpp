@@ -1,9 +1,16 @@
 #include "customscene.h"
 #include "arrow.h"
+#include "connectorrouter.h"
+#include "custompixmapitem.h"
+#include "imagestore.h"
+#include "scenepager.h"
 
 #include <QTextCursor>
 #include <QGraphicsSceneMouseEvent>
 #include <QDebug>
+#include <QGraphicsView>
+#include <QPainter>
+#include <QtMath>
 
 QPen const CustomScene::penForLines = QPen(QBrush(QColor(Qt::black)), 2, Qt::PenStyle::DashLine);
 
@@ -18,59 +25,138 @@ CustomScene::CustomScene(QMenu *itemMenu, QObject *parent)
     myItemColor = Qt::white;
     myTextColor = Qt::black;
     myLineColor = Qt::black;
+
+    arrowUpdateTimer.setSingleShot(true);
+    arrowUpdateTimer.setInterval(0);
+    connect(&arrowUpdateTimer, SIGNAL(timeout()), this, SLOT(flushArrowUpdates()));
+
+    router = new ConnectorRouter(this);
+    connect(router, SIGNAL(arrowRouted(Arrow*)), this, SLOT(arrowRouted(Arrow*)));
 }
 
 void CustomScene::setLineColor(const QColor &color)
 {
     myLineColor = color;
-    foreach (QGraphicsItem* p, selectedItems())
+    beginTransaction(UndoCommand::Restyle);
+    QVector<ItemState> before;
+    foreach (Arrow* item, mySelectedArrows)
     {
-        if (p->type() == Arrow::Type)
-        {
-            Arrow* item = qgraphicsitem_cast<Arrow*>(p);
-            item->setColor(myLineColor);
-            update();
-        }
+        before.append(ItemState::capture(item, ItemState::Style));
+        item->setColor(myLineColor);
+        item->update();
+        invalidateBundle(item);
     }
+    pushCommand(changeCommand(UndoCommand::Restyle, before));
+    commitTransaction();
 }
 
 void CustomScene::setTextColor(const QColor &color)
 {
     myTextColor = color;
-    foreach (QGraphicsItem* p, selectedItems())
+    beginTransaction(UndoCommand::Restyle);
+    QVector<ItemState> before;
+    foreach (CustomTextItem* item, mySelectedTexts)
     {
-        if (p->type() == CustomTextItem::Type)
-        {
-            CustomTextItem* item = qgraphicsitem_cast<CustomTextItem*>(p);
-            item->setDefaultTextColor(myTextColor);
-        }
+        before.append(ItemState::capture(item, ItemState::Style));
+        item->setDefaultTextColor(myTextColor);
     }
+    pushCommand(changeCommand(UndoCommand::Restyle, before));
+    commitTransaction();
 }
 
 void CustomScene::setItemColor(const QColor &color)
 {
     myItemColor = color;
-    foreach (QGraphicsItem* p, selectedItems())
+    beginTransaction(UndoCommand::Restyle);
+    QVector<ItemState> before;
+    foreach (CustomItem* item, mySelectedShapes)
     {
-        if (p->type() == CustomItem::Type)
-        {
-            CustomItem* item = qgraphicsitem_cast<CustomItem*>(p);
-            item->setBrush(myItemColor);
-        }
+        before.append(ItemState::capture(item, ItemState::Style));
+        item->setBrush(myItemColor);
     }
+    pushCommand(changeCommand(UndoCommand::Restyle, before));
+    commitTransaction();
 }
 
 void CustomScene::setFont(const QFont &font)
 {
     myFont = font;
-    foreach (QGraphicsItem* p, selectedItems())
+    beginTransaction(UndoCommand::Restyle);
+    QVector<ItemState> before;
+    foreach (CustomTextItem* item, mySelectedTexts)
     {
-        if (p->type() == CustomTextItem::Type)
-        {
-            CustomTextItem* item = qgraphicsitem_cast<CustomTextItem*>(p);
-            item->setFont(myFont);
-        }
+        before.append(ItemState::capture(item, ItemState::Style));
+        item->setFont(myFont);
+    }
+    pushCommand(changeCommand(UndoCommand::Restyle, before));
+    commitTransaction();
+}
+
+void CustomScene::setGridPitch(int pitch)
+{
+    myGridPitch = qMax(1, pitch);
+}
+
+void CustomScene::setSnapToGrid(bool snap)
+{
+    snapToGridEnabled = snap;
+}
+
+QPointF CustomScene::snapToGrid(const QPointF &pos) const
+{
+    if (!snapToGridEnabled)
+        return pos;
+    return QPointF(qRound(pos.x() / myGridPitch) * qreal(myGridPitch),
+                   qRound(pos.y() / myGridPitch) * qreal(myGridPitch));
+}
+
+void CustomScene::setBundleArrows(bool bundle)
+{
+    bundlingArrows = bundle;
+    arrowBundles.clear();
+    foreach (Arrow *arrow, allArrows)
+    {
+        arrow->setFlag(QGraphicsItem::ItemHasNoContents, bundle && !arrow->isSelected());
+        if (bundle)
+            arrowBundles.update(arrow);
+    }
+    if (bundle)
+    {
+        QVector<QRectF> changed;
+        arrowBundles.rebuildChanged(&changed);
     }
+    update();
+}
+
+void CustomScene::invalidateBundle(Arrow *arrow)
+{
+    if (!bundlingArrows)
+        return;
+    // rebuilt with the other arrow updates of the frame
+    arrowBundles.update(arrow);
+    if (!arrowUpdateTimer.isActive())
+        arrowUpdateTimer.start();
+}
+
+void CustomScene::rebuildBundles()
+{
+    if (!bundlingArrows)
+        return;
+    QVector<QRectF> changed;
+    arrowBundles.rebuildChanged(&changed);
+    foreach (QRectF const& rect, changed)
+        update(rect);
+}
+
+void CustomScene::drawBackground(QPainter *painter, const QRectF &rect)
+{
+    QGraphicsScene::drawBackground(painter, rect);
+    // what the pager has no room for at this zoom
+    if (myPager)
+        myPager->drawOverflow(painter, rect);
+    // under every item, as the arrows themselves are
+    if (bundlingArrows)
+        arrowBundles.draw(painter, rect);
 }
 
 void CustomScene::deleteItems(QList<QGraphicsItem*> const& items)
@@ -100,117 +186,329 @@ void CustomScene::deleteItems(QList<QGraphicsItem*> const& items)
     }
 }
 
-void CustomScene::saveToXml(QDomDocument &doc, QDomElement &root)
+void CustomScene::registerItem(QGraphicsItem *item)
 {
-    QDomElement sceneElement = doc.createElement("Scene");
-    root.appendChild(sceneElement);
+    int id = ItemState::itemId(item);
+    if (id >= 0)
+        itemIndex.insert(id, item);
+    if (item->type() == CustomItem::Type)
+        anchorIndex.insert(item, item->scenePos());
+    if (item->isSelected())
+        itemSelectionChanged(item, true);
+    if (item->type() == Arrow::Type)
+    {
+        Arrow *arrow = qgraphicsitem_cast<Arrow*>(item);
+        allArrows.insert(arrow);
+        arrow->setFlag(QGraphicsItem::ItemHasNoContents, bundlingArrows && !arrow->isSelected());
+        invalidateBundle(arrow);
+    }
+}
 
-    foreach (QGraphicsItem *item, items())
+void CustomScene::unregisterItem(QGraphicsItem *item)
+{
+    int id = ItemState::itemId(item);
+    if (id >= 0 && itemIndex.value(id) == item)
+        itemIndex.remove(id);
+    anchorIndex.remove(item);
+    itemSelectionChanged(item, false);
+    if (item == dragReference)
+        dragReference = nullptr;
+    if (item->type() == Arrow::Type)
     {
-        if (CustomItem *customItem = qgraphicsitem_cast<CustomItem *>(item))
-        {
-            QDomElement itemElement = doc.createElement("CustomItem");
-            itemElement.setAttribute("id", customItem->id());
-            itemElement.setAttribute("type", customItem->customType());
-            itemElement.setAttribute("x", customItem->pos().x());
-            itemElement.setAttribute("y", customItem->pos().y());
-            QPointF center = customItem->boundingRect().center();
-            itemElement.setAttribute("centerX", center.x());
-            itemElement.setAttribute("centerY", center.y());
-            sceneElement.appendChild(itemElement);
-        }
-        else if (Arrow *arrow = qgraphicsitem_cast<Arrow *>(item))
-        {
-            QDomElement arrowElement = doc.createElement("Arrow");
-            arrowElement.setAttribute("startItemId", arrow->startItem()->id());
-            arrowElement.setAttribute("endItemId", arrow->endItem()->id());
-            arrowElement.setAttribute("lineColor", arrow->getColor().name());
-            QPointF intersectPoint = arrow->line().p1();
-            arrowElement.setAttribute("intersectX", intersectPoint.x());
-            arrowElement.setAttribute("intersectY", intersectPoint.y());
-            sceneElement.appendChild(arrowElement);
-        }
-        else if (CustomTextItem *text = qgraphicsitem_cast<CustomTextItem *>(item))
+        Arrow *arrow = qgraphicsitem_cast<Arrow*>(item);
+        pendingArrows.remove(arrow);
+        allArrows.remove(arrow);
+        if (bundlingArrows)
         {
-            QDomElement textElement = doc.createElement("Text");
-            textElement.setAttribute("Name", text->getText());
-            textElement.setAttribute("x", text->pos().x());
-            textElement.setAttribute("y", text->pos().y());
-            sceneElement.appendChild(textElement);
+            arrowBundles.remove(arrow);
+            if (!arrowUpdateTimer.isActive())
+                arrowUpdateTimer.start();
         }
     }
+    else if (item->type() == CustomItem::Type)
+        movedShapes.remove(qgraphicsitem_cast<CustomItem*>(item));
 }
 
-void CustomScene::loadFromXml(const QDomElement &root)
+void CustomScene::itemSelectionChanged(QGraphicsItem *item, bool selected)
 {
-    QDomElement sceneElement = root.firstChildElement("Scene");
-    QDomNodeList itemList = sceneElement.childNodes();
+    if (selected)
+        mySelection.insert(item);
+    else
+        mySelection.remove(item);
+    // arrows follow their shapes, they are never dragged themselves
+    if (item->type() != Arrow::Type)
+    {
+        if (selected)
+            mySelectedMovables.insert(item);
+        else
+            mySelectedMovables.remove(item);
+    }
 
-    // First pass: Create all CustomItems and store them in a map by their ID
-    QMap<int, CustomItem*> itemMap;
+    switch (item->type()) {
+    case CustomItem::Type:
+        if (selected)
+            mySelectedShapes.insert(qgraphicsitem_cast<CustomItem*>(item));
+        else
+            mySelectedShapes.remove(qgraphicsitem_cast<CustomItem*>(item));
+        break;
+    case Arrow::Type:
+        if (selected)
+            mySelectedArrows.insert(qgraphicsitem_cast<Arrow*>(item));
+        else
+            mySelectedArrows.remove(qgraphicsitem_cast<Arrow*>(item));
+        break;
+    case CustomTextItem::Type:
+        if (selected)
+            mySelectedTexts.insert(qgraphicsitem_cast<CustomTextItem*>(item));
+        else
+            mySelectedTexts.remove(qgraphicsitem_cast<CustomTextItem*>(item));
+        break;
+    default:
+        break;
+    }
+}
 
-    for (int i = 0; i < itemList.count(); i++)
+QGraphicsItem *CustomScene::createItem(const ItemState &state)
+{
+    QGraphicsItem *item = nullptr;
+    switch (state.kind) {
+    case ItemState::Shape:
+    {
+        CustomItem *customItem = new CustomItem(CustomItem::CustomType(state.customType), myItemMenu);
+        customItem->setId(state.id);
+        item = customItem;
+        break;
+    }
+    case ItemState::Connector:
+    {
+        CustomItem *startItem = qgraphicsitem_cast<CustomItem*>(itemById(state.startId));
+        CustomItem *endItem = qgraphicsitem_cast<CustomItem*>(itemById(state.endId));
+        if (startItem == nullptr || endItem == nullptr)
+            return nullptr;
+        Arrow *arrow = new Arrow(startItem, endItem);
+        arrow->setId(state.id);
+        arrow->setZValue(-1000.0);
+        startItem->addArrow(arrow);
+        endItem->addArrow(arrow);
+        item = arrow;
+        break;
+    }
+    case ItemState::Text:
+    {
+        CustomTextItem *text = new CustomTextItem();
+        text->setId(state.id);
+        connect(text, SIGNAL(lostFocus(CustomTextItem*)), this, SLOT(editorLostFocus(CustomTextItem*)));
+        connect(text, SIGNAL(selectedChange(QGraphicsItem*)), this, SIGNAL(itemSelected(QGraphicsItem*)));
+        item = text;
+        break;
+    }
+    case ItemState::Pixmap:
     {
-        QDomElement itemElement = itemList.at(i).toElement();
-        QString tagName = itemElement.tagName();
+        CustomPixmapItem *pixmapItem = new CustomPixmapItem(state.image);
+        pixmapItem->setId(state.id);
+        item = pixmapItem;
+        break;
+    }
+    default:
+        return nullptr;
+    }
 
-        if (tagName == "CustomItem")
-        {
-            int id = itemElement.attribute("id").toInt();
-            CustomItem::CustomType type = static_cast<CustomItem::CustomType>(itemElement.attribute("type").toInt());
-            CustomItem* customItem = new CustomItem(type, myItemMenu);
-            customItem->setId(id);
-            customItem->setPos(itemElement.attribute("x").toFloat(), itemElement.attribute("y").toFloat());
-            qreal centerX = itemElement.attribute("centerX").toFloat();
-            qreal centerY = itemElement.attribute("centerY").toFloat();
-            QPointF center(centerX, centerY);
-            addItem(customItem);
-            itemMap[id] = customItem;
-        }
-        else if (tagName == "CustomTextItem")
-        {
-            QString textName = itemElement.attribute("Name");
-            qreal x = itemElement.attribute("x").toFloat();
-            qreal y = itemElement.attribute("y").toFloat();
-
-            CustomTextItem* textItem = new CustomTextItem();
-            textItem->setText(textName);
-            textItem->setPos(x, y);
-            addItem(textItem);
-        }
+    state.applyTo(item);
+    addItem(item);
+    if (item->type() == Arrow::Type)
+    {
+        // a saved route that still reaches its endpoints is kept, the
+        // others are routed afresh
+        Arrow *arrow = qgraphicsitem_cast<Arrow*>(item);
+        arrow->updatePosition();
+        if (arrow->route().isEmpty())
+            router->reroute(arrow);
     }
+    // an item undo brings back is paged like the others again
+    if (myPager)
+        myPager->restore(state.id);
+    return item;
+}
+
+void CustomScene::removeItemById(int id)
+{
+    QGraphicsItem *item = itemById(id);
+    if (item)
+        deleteItems(QList<QGraphicsItem*>() << item);
+}
 
-    // Second pass: Create all Arrows using the previously created CustomItems
-    for (int i = 0; i < itemList.count(); i++)
+void CustomScene::reconcile(const QVector<ItemState> &targets, const QVector<int> &removals)
+{
+    // Patches the scene towards the target states by item id. Items are
+    // created only when missing and removed only when named, everything
+    // else is updated in place and keeps its identity and selection.
+    QList<QGraphicsItem*> removed;
+    foreach (int id, removals)
     {
-        QDomElement itemElement = itemList.at(i).toElement();
-        QString tagName = itemElement.tagName();
+        markDirty(id);
+        if (QGraphicsItem *item = itemById(id))
+            removed.append(item);
+        else if (myPager)
+            myPager->forget(id);
+    }
+    if (!removed.isEmpty())
+        deleteItems(removed);
 
-        if (tagName == "Arrow")
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        // shapes before the connectors that refer to them
+        foreach (ItemState const& target, targets)
         {
-            int startItemId = itemElement.attribute("startItemId").toInt();
-            int endItemId = itemElement.attribute("endItemId").toInt();
-            QColor color(itemElement.attribute("lineColor"));
+            if ((target.kind == ItemState::Connector) != (pass == 1)) continue;
+            markDirty(target.id);
+
+            QGraphicsItem *item = itemById(target.id);
+            if (item == nullptr && myPager)
+                item = myPager->fetch(target.id);
+            if (item == nullptr)
+            {
+                if (target.fields == ItemState::AllFields)
+                    createItem(target);
+                continue;
+            }
+            // moved and reshaped shapes mark their arrows themselves
+            target.applyTo(item);
+            // a route that no longer fits its endpoints was dropped
+            if (Arrow *arrow = qgraphicsitem_cast<Arrow*>(item))
+            {
+                if (arrow->route().isEmpty())
+                    router->reroute(arrow);
+                // restyled arrows
+                invalidateBundle(arrow);
+            }
+        }
+    }
+    flushArrowUpdates();
+}
+
+void CustomScene::beginTransaction(UndoCommand::Kind kind)
+{
+    if (transactionDepth++ > 0) return;
 
-            CustomItem* startItem = itemMap[startItemId];
-            CustomItem* endItem = itemMap[endItemId];
+    transactionCommand = new UndoCommand(kind);
+    foreach (QGraphicsView *view, views())
+        view->viewport()->setUpdatesEnabled(false);
+}
 
-            if (startItem && endItem)
+void CustomScene::commitTransaction()
+{
+    if (transactionDepth == 0 || --transactionDepth > 0) return;
+
+    UndoCommand *command = transactionCommand;
+    transactionCommand = nullptr;
+    // re-enabling the viewports repaints each of them once
+    foreach (QGraphicsView *view, views())
+        view->viewport()->setUpdatesEnabled(true);
+    pushCommand(command);
+}
+
+void CustomScene::pushCommand(UndoCommand *command)
+{
+    if (transactionCommand)
+    {
+        transactionCommand->merge(*command);
+        delete command;
+        return;
+    }
+    foreach (int id, command->itemIds())
+        markDirty(id);
+    if (myUndoSystem)
+    {
+        myUndoSystem->push(command);
+        emit historyChanged();
+    }
+    else
+    {
+        delete command;
+    }
+}
+
+void CustomScene::recordInsertion(UndoCommand::Kind kind, const QList<QGraphicsItem*> &items)
+{
+    UndoCommand *command = new UndoCommand(kind);
+    foreach (QGraphicsItem *item, items)
+    {
+        ItemState state = ItemState::capture(item);
+        if (state.isValid())
+            command->addChange(ItemState(), state);
+    }
+    pushCommand(command);
+}
+
+void CustomScene::recordDeletion(const QList<QGraphicsItem*> &items)
+{
+    // deleting a shape takes its arrows with it, so record those too
+    UndoCommand *command = new UndoCommand(UndoCommand::Delete);
+    QSet<int> recorded;
+    foreach (QGraphicsItem *item, items)
+    {
+        if (item->type() == CustomItem::Type)
+        {
+            foreach (Arrow *arrow, qgraphicsitem_cast<CustomItem*>(item)->getArrows())
             {
-                Arrow* arrow = new Arrow(startItem, endItem);
-                arrow->setColor(color);
-                qreal intersectX = itemElement.attribute("intersectX").toFloat();
-                qreal intersectY = itemElement.attribute("intersectY").toFloat();
-                QPointF intersectPoint(intersectX, intersectY);
-
-                addItem(arrow);
-                startItem->addArrow(arrow);
-                endItem->addArrow(arrow);
-                arrow->updatePosition();
+                if (recorded.contains(arrow->id())) continue;
+                recorded.insert(arrow->id());
+                command->addChange(ItemState::capture(arrow), ItemState());
             }
         }
+        ItemState state = ItemState::capture(item);
+        if (!state.isValid() || recorded.contains(state.id)) continue;
+        recorded.insert(state.id);
+        command->addChange(state, ItemState());
     }
+    pushCommand(command);
+}
+
+UndoCommand *CustomScene::changeCommand(UndoCommand::Kind kind, const QVector<ItemState> &before)
+{
+    UndoCommand *command = new UndoCommand(kind);
+    foreach (ItemState const& state, before)
+    {
+        QGraphicsItem *item = itemById(state.id);
+        if (state.isValid() && item)
+            command->addChange(state, ItemState::capture(item, state.fields));
+    }
+    return command;
+}
 
+void CustomScene::takeChanges(QVector<ItemState> *changed, QVector<int> *removedIds)
+{
+    foreach (int id, dirtyIds)
+    {
+        QGraphicsItem *item = itemById(id);
+        if (item)
+            changed->append(ItemState::capture(item));
+        else
+            removedIds->append(id);
+    }
+    dirtyIds.clear();
+}
+
+QVector<ItemState> CustomScene::snapshot() const
+{
+    // shapes and texts first, so a streaming reader can connect each arrow
+    // as soon as it meets it
+    QVector<ItemState> states;
+    QList<QGraphicsItem*> arrows;
+    foreach (QGraphicsItem *item, items())
+    {
+        if (item->type() == Arrow::Type)
+        {
+            arrows.append(item);
+            continue;
+        }
+        ItemState state = ItemState::capture(item);
+        if (state.isValid())
+            states.append(state);
+    }
+    foreach (QGraphicsItem *item, arrows)
+        states.append(ItemState::capture(item));
+    return states;
 }
 
 void CustomScene::setMode(Mode mode)
@@ -231,11 +529,27 @@ void CustomScene::editorLostFocus(CustomTextItem *item)
     item->setTextCursor(cursor);
 
     if (item->toPlainText().isEmpty()) {
+        if (item->contentIsUpdated() && !item->previousText().isEmpty()) {
+            ItemState before = ItemState::capture(item);
+            before.text = item->previousText();
+            UndoCommand *command = new UndoCommand(UndoCommand::Delete);
+            command->addChange(before, ItemState());
+            pushCommand(command);
+        }
         removeItem(item);
         item->deleteLater();
     } else {
         if (item->contentIsUpdated()) {
             qDebug() << "content update ---";
+            if (item->previousText().isEmpty()) {
+                recordInsertion(UndoCommand::Insert, QList<QGraphicsItem*>() << item);
+            } else {
+                ItemState before = ItemState::capture(item, ItemState::Content);
+                before.text = item->previousText();
+                UndoCommand *command = new UndoCommand(UndoCommand::TextEdit);
+                command->addChange(before, ItemState::capture(item, ItemState::Content));
+                pushCommand(command);
+            }
             emit textChanged();
         }
     }
@@ -271,11 +585,11 @@ void CustomScene::dropEvent(QGraphicsSceneDragDropEvent *event)
         QPixmap pixmap;
         dataStream >> pixmap;
 
-        QGraphicsPixmapItem *newItem = new QGraphicsPixmapItem(pixmap);
-        newItem->setPos(event->scenePos());
-        newItem->setFlag(QGraphicsItem::ItemIsMovable);
-        newItem->setFlag(QGraphicsItem::ItemIsSelectable);
+        // identical sprites share one stored image
+        CustomPixmapItem *newItem = new CustomPixmapItem(ImageStore::insert(pixmap));
+        newItem->setPos(snapToGrid(event->scenePos()));
         addItem(newItem);
+        recordInsertion(UndoCommand::Insert, QList<QGraphicsItem*>() << newItem);
 
         event->setDropAction(Qt::CopyAction);
         event->accept();
@@ -295,7 +609,8 @@ void CustomScene::mousePressEvent(QGraphicsSceneMouseEvent *mouseEvent)
         item = new CustomItem(myItemType, myItemMenu);
         item->setBrush(myItemColor);
         addItem(item);
-        item->setPos(mouseEvent->scenePos());
+        item->setPos(snapToGrid(mouseEvent->scenePos()));
+        recordInsertion(UndoCommand::Insert, QList<QGraphicsItem*>() << item);
         qDebug() << "insert item at: " << mouseEvent->scenePos();
         qDebug() << "\ttype: " << myItemType << " color: " << myItemColor;
         emit itemInserted(item);
@@ -314,11 +629,11 @@ void CustomScene::mousePressEvent(QGraphicsSceneMouseEvent *mouseEvent)
         textItem->setFont(myFont);
         textItem->setTextInteractionFlags(Qt::TextEditorInteraction);
         textItem->setZValue(1000.0);
-        connect(textItem, SIGNAL(lostFocus(CustomTextItem*)), this, SLOT(editorLostFocus(DiagramTextItem*)));
+        connect(textItem, SIGNAL(lostFocus(CustomTextItem*)), this, SLOT(editorLostFocus(CustomTextItem*)));
         connect(textItem, SIGNAL(selectedChange(QGraphicsItem*)), this, SIGNAL(itemSelected(QGraphicsItem*)));
         addItem(textItem);
         textItem->setDefaultTextColor(myTextColor);
-        textItem->setPos(mouseEvent->scenePos());
+        textItem->setPos(snapToGrid(mouseEvent->scenePos()));
         emit textInserted(textItem);
         qDebug() << "text inserted at" << textItem->scenePos();
         break;
@@ -327,6 +642,8 @@ void CustomScene::mousePressEvent(QGraphicsSceneMouseEvent *mouseEvent)
         hasItemSelected = itemAt(mouseEvent->scenePos(), QTransform()) != nullptr;
     }
     QGraphicsScene::mousePressEvent(mouseEvent);
+    if (myMode == MoveItem)
+        beginDragRecording();
 }
 
 void CustomScene::mouseMoveEvent(QGraphicsSceneMouseEvent *mouseEvent)
@@ -338,9 +655,12 @@ void CustomScene::mouseMoveEvent(QGraphicsSceneMouseEvent *mouseEvent)
     }
     else if (myMode == MoveItem)
     {
+        batchingMoves = true;
         if (hasItemSelected)
             mouseDraggingMoveEvent(mouseEvent);
         QGraphicsScene::mouseMoveEvent(mouseEvent);
+        batchingMoves = false;
+        flushArrowUpdates();
     }
 }
 
@@ -350,10 +670,13 @@ void CustomScene::mouseReleaseEvent(QGraphicsSceneMouseEvent *mouseEvent)
 
     horizontalStickyMode = false;
     verticalStickyMode = false;
-    foreach(QGraphicsItem* p, selectedItems())
-        p->setFlag(QGraphicsItem::ItemIsMovable);
+    foreach(QGraphicsItem* p, mySelection)
+    {
+        if (p->type() != Arrow::Type)
+            p->setFlag(QGraphicsItem::ItemIsMovable);
+    }
 
-    clearOrthogonalLines();
+    clearGuides();
     if (line != nullptr && myMode == InsertLine)
     {
         QList<QGraphicsItem *> startItems = items(line->line().p1());
@@ -380,12 +703,15 @@ void CustomScene::mouseReleaseEvent(QGraphicsSceneMouseEvent *mouseEvent)
             arrow->setZValue(-1000.0);
             addItem(arrow);
             arrow->updatePosition();
+            router->reroute(arrow);
+            recordInsertion(UndoCommand::Connect, QList<QGraphicsItem*>() << arrow);
             emit arrowInserted();
         }
     }
 
     line = nullptr;
     QGraphicsScene::mouseReleaseEvent(mouseEvent);
+    finishDragRecording();
 }
 
 void CustomScene::wheelEvent(QGraphicsSceneWheelEvent* wheelEvent)
@@ -403,58 +729,115 @@ void CustomScene::wheelEvent(QGraphicsSceneWheelEvent* wheelEvent)
 
 void CustomScene::mouseDraggingMoveEvent(QGraphicsSceneMouseEvent* event)
 {
-    clearOrthogonalLines();
-    if ((event->buttons() & Qt::LeftButton) != 0 && selectedItems().size() == 1)
+    GuideList previous = guides;
+    guides.resize(0);
+    QSet<QGraphicsItem*> const& selection = mySelectedMovables;
+    if ((event->buttons() & Qt::LeftButton) != 0 && !selection.isEmpty())
     {
-        QGraphicsItem* itemUnderCursor = selectedItems().first();
-        QPointF curCenter = itemUnderCursor->scenePos();
         QPointF const& mousePos = event->scenePos();
 
-        foreach(QGraphicsItem* p, items())
+        tryEnteringStickyMode(selection, mousePos);
+
+        // guides through the shapes the selection is aligned with; on the
+        // grid only exact matches count
+        QRectF bounds = sceneRect();
+        qreal tolerance = snapToGridEnabled ? 0 : Delta;
+        qreal x, y;
+        QPointF offset = dragOffset();
+        foreach (QPointF anchor, dragAnchors)
         {
-            if (p->type() != CustomItem::Type || p == itemUnderCursor) continue;
+            anchor += offset;
+            if (anchorIndex.nearestY(anchor.y(), tolerance, selection, &y))
+                addGuide(QLineF(bounds.left(), y, bounds.right(), y));
+            if (anchorIndex.nearestX(anchor.x(), tolerance, selection, &x))
+                addGuide(QLineF(x, bounds.top(), x, bounds.bottom()));
+        }
+        tryLeavingStickyMode(selection, mousePos);
+    }
+    updateGuides(previous);
+}
 
-            CustomItem* item = qgraphicsitem_cast<CustomItem*>(p);
-            QPointF const& objPoint = item->scenePos();
-            LineAttr lineAttr;
+void CustomScene::clearGuides()
+{
+    GuideList previous = guides;
+    guides.resize(0);
+    updateGuides(previous);
+}
 
-            tryEnteringStickyMode(itemUnderCursor, objPoint, mousePos);
+void CustomScene::addGuide(const QLineF &guide)
+{
+    // several anchors of a selection often line up with the same shape
+    if (guides.size() < MaxGuides && !guides.contains(guide))
+        guides.append(guide);
+}
 
-            if ((lineAttr = getPointsRelationship(objPoint, curCenter)) != Other)
-            {
-                if ((lineAttr & Horizontal) != 0) {
-                    QGraphicsLineItem* newHLine = new QGraphicsLineItem();
-                    newHLine->setLine(QLineF(QPointF(0, objPoint.y()),
-                                             QPointF(sceneRect().width(), objPoint.y())));
-                    newHLine->setPen(penForLines);
-                    orthogonalLines.append(newHLine);
-                }
-                if ((lineAttr & Vertical) != 0)
-                {
-                    QGraphicsLineItem* newVLine = new QGraphicsLineItem();
-                    newVLine->setLine(QLineF(QPointF(objPoint.x(), 0),
-                                             QPointF(objPoint.x(), sceneRect().height())));
-                    newVLine->setPen(penForLines);
-                    orthogonalLines.append(newVLine);
-                }
-            }
-        }
-        tryLeavingStickyMode(itemUnderCursor, mousePos);
-    }
-    foreach(QGraphicsLineItem* p, orthogonalLines)
+void CustomScene::updateGuides(const GuideList &previous)
+{
+    // repaint only the strips under the old and the new guides
+    if (guides == previous)
+        return;
+    qreal margin = penForLines.widthF();
+    foreach (QLineF const& guide, previous)
+        update(QRectF(guide.p1(), guide.p2()).normalized().adjusted(-margin, -margin, margin, margin));
+    foreach (QLineF const& guide, guides)
+        update(QRectF(guide.p1(), guide.p2()).normalized().adjusted(-margin, -margin, margin, margin));
+}
+
+void CustomScene::drawForeground(QPainter *painter, const QRectF &rect)
+{
+    QGraphicsScene::drawForeground(painter, rect);
+    if (guides.isEmpty())
+        return;
+    painter->save();
+    painter->setPen(penForLines);
+    painter->drawLines(guides.constData(), guides.size());
+    painter->restore();
+}
+
+void CustomScene::beginDragRecording()
+{
+    collectDragAnchors();
+    dragStartStates.clear();
+    foreach (QGraphicsItem* p, mySelection)
     {
-        addItem(p);
+        if (p->type() == CustomItem::Type || p->type() == CustomTextItem::Type
+                || p->type() == CustomPixmapItem::Type)
+            dragStartStates.append(ItemState::capture(p, ItemState::Position | ItemState::Geometry));
     }
 }
 
-void CustomScene::clearOrthogonalLines()
+void CustomScene::finishDragRecording()
 {
-    foreach(QGraphicsLineItem* p, orthogonalLines)
+    QVector<ItemState> before;
+    QVector<ItemState> after;
+    bool resized = false;
+    foreach (ItemState const& state, dragStartStates)
     {
-        removeItem(p);
-        delete p;
+        QGraphicsItem *item = itemById(state.id);
+        if (!item) continue;
+        ItemState current = ItemState::capture(item, state.fields);
+        if (current.pos == state.pos && current.polygon == state.polygon) continue;
+        resized |= current.polygon != state.polygon;
+        before.append(state);
+        after.append(current);
     }
-    orthogonalLines.clear();
+    dragStartStates.clear();
+    dragAnchors.clear();
+    dragReference = nullptr;
+    if (before.isEmpty()) return;
+
+    UndoCommand *command = new UndoCommand(resized ? UndoCommand::Resize : UndoCommand::Move);
+    for (int i = 0; i < before.size(); ++i)
+    {
+        if (!resized)
+        {
+            // a plain move only needs the positions
+            before[i].fields = after[i].fields = ItemState::Position;
+            before[i].polygon = after[i].polygon = QPolygonF();
+        }
+        command->addChange(before[i], after[i]);
+    }
+    pushCommand(command);
 }
 
 bool CustomScene::closeEnough(qreal x, qreal y, qreal delta)
@@ -470,53 +853,157 @@ CustomScene::LineAttr CustomScene::getPointsRelationship(const QPointF& p1, cons
     return static_cast<CustomScene::LineAttr>(ret);
 }
 
-void CustomScene::tryEnteringStickyMode(QGraphicsItem* item, const QPointF& target, const QPointF& mousePos)
+void CustomScene::collectDragAnchors()
 {
-    QPointF const& itemPos = item->scenePos();
-    if (!verticalStickyMode) {
-        if (closeEnough(itemPos.x(), target.x(), stickyDistance))
-        {  // enter stickyMode
-            verticalStickyMode = true;
-            verticalStickPoint = mousePos;
-            item->setFlag(QGraphicsItem::ItemIsMovable, false);
-            item->setPos(QPointF(target.x(), itemPos.y()));
-        }
-    }
-    if (!horizontalStickyMode)
+    // the anchor of each item and the center of the selection as a whole;
+    // a large selection is matched by its center alone. The selection moves
+    // as one, so during the drag they only follow the first item.
+    dragAnchors.clear();
+    dragReference = nullptr;
+    int count = mySelectedMovables.size();
+    QRectF bounds;
+    foreach (QGraphicsItem* item, mySelectedMovables)
     {
-        if (closeEnough(itemPos.y(), target.y(), stickyDistance))
+        if (dragReference == nullptr)
         {
-            horizontalStickyMode = true;
-            horizontalStickPoint = mousePos;
-            item->setFlag(QGraphicsItem::ItemIsMovable, false);
-            item->setPos(QPointF(itemPos.x(), target.y()));
+            dragReference = item;
+            dragOrigin = item->scenePos();
         }
+        bounds = bounds.united(item->sceneBoundingRect());
+        if (count <= MaxSnapAnchors)
+            dragAnchors.append(item->scenePos());
+    }
+    if (count > 1)
+        dragAnchors.append(bounds.center());
+}
+
+QPointF CustomScene::dragOffset() const
+{
+    return dragReference ? dragReference->scenePos() - dragOrigin : QPointF();
+}
+
+void CustomScene::translateItems(const QSet<QGraphicsItem*> &items, qreal dx, qreal dy)
+{
+    if (dx == 0 && dy == 0) return;
+    foreach (QGraphicsItem* item, items)
+        item->moveBy(dx, dy);
+}
+
+void CustomScene::tryEnteringStickyMode(const QSet<QGraphicsItem*> &selection, const QPointF& mousePos)
+{
+    if (verticalStickyMode && horizontalStickyMode) return;
+
+    // the smallest offset that puts one of the anchors on a shape's
+    qreal dx = stickyDistance, dy = stickyDistance;
+    qreal target;
+    QPointF offset = dragOffset();
+    foreach (QPointF anchor, dragAnchors)
+    {
+        anchor += offset;
+        if (!verticalStickyMode && anchorIndex.nearestX(anchor.x(), stickyDistance, selection, &target)
+                && qAbs(target - anchor.x()) < qAbs(dx))
+            dx = target - anchor.x();
+        if (!horizontalStickyMode && anchorIndex.nearestY(anchor.y(), stickyDistance, selection, &target)
+                && qAbs(target - anchor.y()) < qAbs(dy))
+            dy = target - anchor.y();
+    }
+
+    bool enterVertical = qAbs(dx) < stickyDistance;
+    bool enterHorizontal = qAbs(dy) < stickyDistance;
+    if (!enterVertical && !enterHorizontal) return;
+
+    if (enterVertical)
+    {  // enter stickyMode
+        verticalStickyMode = true;
+        verticalStickPoint = mousePos;
+    }
+    if (enterHorizontal)
+    {
+        horizontalStickyMode = true;
+        horizontalStickPoint = mousePos;
     }
+    // the selection is moved here from now on, as one
+    foreach (QGraphicsItem* item, selection)
+        item->setFlag(QGraphicsItem::ItemIsMovable, false);
+    translateItems(selection, enterVertical ? dx : 0, enterHorizontal ? dy : 0);
 }
 
-void CustomScene::tryLeavingStickyMode(QGraphicsItem* item, const QPointF& mousePos)
+void CustomScene::tryLeavingStickyMode(const QSet<QGraphicsItem*> &selection, const QPointF& mousePos)
 {
     if (verticalStickyMode)
     {
-        item->moveBy(0, mousePos.y() - verticalStickPoint.y());
+        translateItems(selection, 0, mousePos.y() - verticalStickPoint.y());
         verticalStickPoint.setY(mousePos.y());
 
         if (!closeEnough(mousePos.x(), verticalStickPoint.x(), stickyDistance))
-        {
             verticalStickyMode = false;
-            item->setFlag(QGraphicsItem::ItemIsMovable, true);
-        }
     }
     if (horizontalStickyMode)
     {
-        item->moveBy(mousePos.x() - horizontalStickPoint.x(), 0);
+        translateItems(selection, mousePos.x() - horizontalStickPoint.x(), 0);
         horizontalStickPoint.setX(mousePos.x());
 
         if (!closeEnough(mousePos.y(), horizontalStickPoint.y(), stickyDistance))
-        {
             horizontalStickyMode = false;
+    }
+    if (!verticalStickyMode && !horizontalStickyMode)
+    {
+        foreach (QGraphicsItem* item, selection)
             item->setFlag(QGraphicsItem::ItemIsMovable, true);
+    }
+}
+
+void CustomScene::scheduleArrowUpdates(CustomItem *item)
+{
+    foreach (Arrow *arrow, item->getArrows())
+        pendingArrows.insert(arrow);
+    movedShapes.insert(item);
+    // a drag flushes at the end of its mouse move
+    if (!batchingMoves && !arrowUpdateTimer.isActive())
+        arrowUpdateTimer.start();
+}
+
+void CustomScene::flushArrowUpdates()
+{
+    arrowUpdateTimer.stop();
+    // a moved endpoint makes the route stale
+    foreach (Arrow *arrow, pendingArrows)
+    {
+        bool routed = !arrow->route().isEmpty();
+        arrow->updatePosition();
+        invalidateBundle(arrow);
+        if (arrow->route().isEmpty())
+        {
+            // the dropped route must not stay in the file if no new one comes
+            if (routed)
+                markDirty(arrow->id());
+            router->reroute(arrow);
         }
     }
+    pendingArrows.clear();
+
+    // and so does a shape moved onto it
+    foreach (CustomItem *shape, movedShapes)
+    {
+        QRectF rect = shape->sceneBoundingRect();
+        foreach (QGraphicsItem *item, items(rect))
+        {
+            if (item->type() != Arrow::Type) continue;
+            Arrow *arrow = qgraphicsitem_cast<Arrow*>(item);
+            if (arrow->startItem() != shape && arrow->endItem() != shape && arrow->routeCrosses(rect))
+                router->reroute(arrow);
+        }
+    }
+    movedShapes.clear();
+
+    // only the bundles the arrows left or joined
+    arrowUpdateTimer.stop();
+    rebuildBundles();
 }
 
+void CustomScene::arrowRouted(Arrow *arrow)
+{
+    // routes are saved with the document; only a changed one gets here
+    markDirty(arrow->id());
+    invalidateBundle(arrow);
+}
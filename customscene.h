@@ -1,10 +1,13 @@
 #ifndef CUSTOMSCENE_H
 #define CUSTOMSCENE_H
 
+#include "anchorindex.h"
+#include "arrowbundles.h"
 #include "customitem.h"
 #include "customtextitem.h"
+#include "itemstate.h"
+#include "undosystem.h"
 
-#include <QDomDocument>
 #include <QGraphicsScene>
 #include <QGraphicsSceneMouseEvent>
 #include <QMenu>
@@ -13,7 +16,16 @@
 #include <QFont>
 #include <QGraphicsTextItem>
 #include <QColor>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+#include <QIODevice>
 #include <QMimeData>
+#include <QVarLengthArray>
+#include <QVector>
+
+class ConnectorRouter;
+class ScenePager;
 
 class CustomScene : public QGraphicsScene
 {
@@ -34,17 +46,88 @@ public:
     void setItemColor(const QColor &color);
     void setFont(const QFont &font);
 
+    // With snapping on, positions the user sets land on multiples of the
+    // grid pitch, where the lines and checks of the grid backgrounds are.
+    int gridPitch() const { return myGridPitch; }
+    void setGridPitch(int pitch);
+    bool snapsToGrid() const { return snapToGridEnabled; }
+    QPointF snapToGrid(QPointF const& pos) const;
+
+    // With bundling on, unselected arrows are not painted as items but in
+    // shared bundles under every item; they are still hit and selected as
+    // usual, and a selected arrow paints itself. An arrow that moved or
+    // changed refiles its bundle; the bundles it left or joined are rebuilt
+    // and repainted with the next pass of arrow updates.
+    bool bundlesArrows() const { return bundlingArrows; }
+    void invalidateBundle(Arrow *arrow);
+
     // utilities
     void deleteItems(QList<QGraphicsItem*> const& items);
-    void saveToXml(QDomDocument &doc, QDomElement &root);
-    void loadFromXml(const QDomElement &root);
+    QVector<ItemState> snapshot() const;
+
+    // items changed since the last save, for incremental saves
+    void takeChanges(QVector<ItemState> *changed, QVector<int> *removedIds);
+    void clearChanges() { dirtyIds.clear(); }
+    int itemCount() const { return itemIndex.size(); }
+
+    // items changed since the document was opened; saves keep these
+    bool wasEdited(int id) const { return editedIds.contains(id); }
+    void clearEdits() { editedIds.clear(); }
+
+    // pages in items the undo history refers to but the scene released
+    void setPager(ScenePager *pager) { myPager = pager; }
+
+    // The selection, kept up to date from the items' own selection changes
+    // and bucketed by type, so it can be walked without a scan of the scene.
+    // Item groups are not tracked.
+    QSet<QGraphicsItem*> const& selection() const { return mySelection; }
+    QSet<CustomItem*> const& selectedShapes() const { return mySelectedShapes; }
+    QSet<Arrow*> const& selectedArrows() const { return mySelectedArrows; }
+    QSet<CustomTextItem*> const& selectedTexts() const { return mySelectedTexts; }
+    void itemSelectionChanged(QGraphicsItem *item, bool selected);
+
+    // item registry, keyed by the stable item id
+    void registerItem(QGraphicsItem *item);
+    void unregisterItem(QGraphicsItem *item);
+    QGraphicsItem *itemById(int id) const { return itemIndex.value(id, nullptr); }
+    // shapes report their own moves and those of a group they are in
+    void anchorMoved(QGraphicsItem *item) { anchorIndex.move(item, item->scenePos()); }
+
+    // Moved or reshaped shapes mark their arrows dirty; the scene updates each dirty
+    // arrow once, after the mouse move that dragged them or, for any other
+    // move, from the event loop before the next frame. Arrows whose route
+    // went stale, or now runs through a moved shape, are routed again.
+    bool isBatchingMoves() const { return batchingMoves; }
+    void scheduleArrowUpdates(CustomItem *item);
+    QGraphicsItem *createItem(ItemState const& state);
+    void removeItemById(int id);
+    void reconcile(QVector<ItemState> const& targets, QVector<int> const& removals);
+
+    // undo recording
+    void setUndoSystem(UndoSystem *undoSystem) { myUndoSystem = undoSystem; }
+    void pushCommand(UndoCommand *command);
+    void recordInsertion(UndoCommand::Kind kind, QList<QGraphicsItem*> const& items);
+    void recordDeletion(QList<QGraphicsItem*> const& items);
+    UndoCommand *changeCommand(UndoCommand::Kind kind, QVector<ItemState> const& before);
+
+    // Batches edits: everything pushed between begin and commit becomes a
+    // single undo step, and the views repaint once at commit.
+    void beginTransaction(UndoCommand::Kind kind);
+    void commitTransaction();
+    bool inTransaction() const { return transactionDepth > 0; }
 
 
 public slots:
     void setMode(Mode mode);
+    void flushArrowUpdates();
     void setItemType(CustomItem::CustomType type);
+    void setSnapToGrid(bool snap);
+    void setBundleArrows(bool bundle);
     void editorLostFocus(CustomTextItem *item);
 
+private slots:
+    void arrowRouted(Arrow *arrow);
+
 signals:
     void itemInserted(CustomItem *item);
     void textInserted(QGraphicsTextItem *item);
@@ -52,6 +135,7 @@ signals:
     void arrowInserted();
     void itemSelected(QGraphicsItem *item);
     void scaleChanging(int delta);
+    void historyChanged();
 
 protected:
     void mousePressEvent(QGraphicsSceneMouseEvent *mouseEvent) override;
@@ -63,16 +147,29 @@ protected:
     void dragMoveEvent(QGraphicsSceneDragDropEvent *event)override;
     void dragEnterEvent(QGraphicsSceneDragDropEvent *event)override;
     void dropEvent(QGraphicsSceneDragDropEvent *event)override;
+    void drawBackground(QPainter *painter, const QRectF &rect) override;
+    void drawForeground(QPainter *painter, const QRectF &rect) override;
 
 private:
+    enum LineAttr { Other = 0, Horizontal, Vertical, Both};
+    typedef QVarLengthArray<QLineF, 8> GuideList;
+
     void mouseDraggingMoveEvent(QGraphicsSceneMouseEvent* event);
-    void clearOrthogonalLines();
+    void clearGuides();
+    void addGuide(QLineF const& guide);
+    void updateGuides(GuideList const& previous);
+    void beginDragRecording();
+    void finishDragRecording();
+    void rebuildBundles();
+    void markDirty(int id) { dirtyIds.insert(id); editedIds.insert(id); }
     inline bool closeEnough(qreal x, qreal y, qreal delta);
-    enum LineAttr { Other = 0, Horizontal, Vertical, Both};
 
     LineAttr getPointsRelationship(QPointF const& p1, QPointF const& p2);
-    void tryEnteringStickyMode(QGraphicsItem* item, QPointF const& target, QPointF const& mousePos);
-    void tryLeavingStickyMode(QGraphicsItem* item, QPointF const& mousePos);
+    void collectDragAnchors();
+    QPointF dragOffset() const;
+    void translateItems(QSet<QGraphicsItem*> const& items, qreal dx, qreal dy);
+    void tryEnteringStickyMode(QSet<QGraphicsItem*> const& selection, QPointF const& mousePos);
+    void tryLeavingStickyMode(QSet<QGraphicsItem*> const& selection, QPointF const& mousePos);
 
     CustomItem::CustomType myItemType;
 
@@ -91,11 +188,43 @@ private:
     bool verticalStickyMode = false;
     QPointF horizontalStickPoint;
     QPointF verticalStickPoint;
-    QList<QGraphicsLineItem*> orthogonalLines;
+    // alignment guides, drawn over the scene rather than added as items
+    GuideList guides;
+    bool batchingMoves = false;
+    QSet<Arrow*> pendingArrows;
+    QSet<CustomItem*> movedShapes;
+    QSet<Arrow*> allArrows;
+    ArrowBundles arrowBundles;
+    bool bundlingArrows = false;
+    QTimer arrowUpdateTimer;
+    ConnectorRouter *router;
 
     bool hasItemSelected = false;
+    bool snapToGridEnabled = false;
+    int myGridPitch = 32;
+
+    QHash<int, QGraphicsItem*> itemIndex;
+    QSet<QGraphicsItem*> mySelection;
+    QSet<CustomItem*> mySelectedShapes;
+    QSet<Arrow*> mySelectedArrows;
+    QSet<QGraphicsItem*> mySelectedMovables;  // all but the arrows
+    QSet<CustomTextItem*> mySelectedTexts;
+    AnchorIndex anchorIndex;
+    QSet<int> dirtyIds;
+    QSet<int> editedIds;
+    ScenePager *myPager = nullptr;
+    UndoSystem *myUndoSystem = nullptr;
+    UndoCommand *transactionCommand = nullptr;
+    int transactionDepth = 0;
+    QVector<ItemState> dragStartStates;
+    // snap anchors of the dragged selection where the drag started
+    QVector<QPointF> dragAnchors;
+    QGraphicsItem *dragReference = nullptr;
+    QPointF dragOrigin;
 
     static const QPen penForLines;
+    static const int MaxGuides = 8;
+    static const int MaxSnapAnchors = 64;
     static constexpr qreal Delta = 0.1;
     static constexpr qreal stickyDistance = 5;
 };
@@ -1,5 +1,7 @@
 #include "customtextitem.h"
 #include "customscene.h"
+#include "itemstate.h"
+#include "levelofdetail.h"
 #include <QDebug>
 #include <QTextCursor>
 
@@ -9,7 +11,28 @@ CustomTextItem::CustomTextItem(QGraphicsItem *parent)
 {
     setFlag(QGraphicsItem::ItemIsMovable);
     setFlag(QGraphicsItem::ItemIsSelectable);
+    setFlag(QGraphicsItem::ItemSendsGeometryChanges);
     positionLastTime = QPointF(0, 0);
+    myId = ItemState::allocateId();
+}
+
+CustomTextItem::~CustomTextItem()
+{
+    if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+        customScene->unregisterItem(this);
+}
+
+void CustomTextItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    // text being edited is always drawn as text
+    if (hasFocus() || !LevelOfDetail::drawTextPlaceholder(this, painter))
+        QGraphicsTextItem::paint(painter, option, widget);
+}
+
+void CustomTextItem::setId(int id)
+{
+    myId = id;
+    ItemState::reserveId(id);
 }
 
 CustomTextItem* CustomTextItem::clone()
@@ -28,7 +51,27 @@ QVariant CustomTextItem::itemChange(GraphicsItemChange change,
                      const QVariant &value)
 {
     if (change == QGraphicsItem::ItemSelectedHasChanged)
+    {
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            customScene->itemSelectionChanged(this, value.toBool());
         emit selectedChange(this);
+    }
+    else if (change == QGraphicsItem::ItemPositionChange)
+    {
+        CustomScene *customScene = qobject_cast<CustomScene*>(scene());
+        if (customScene && customScene->isBatchingMoves())
+            return customScene->snapToGrid(value.toPointF());
+    }
+    else if (change == QGraphicsItem::ItemSceneChange)
+    {
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            customScene->unregisterItem(this);
+    }
+    else if (change == QGraphicsItem::ItemSceneHasChanged)
+    {
+        if (CustomScene *customScene = qobject_cast<CustomScene*>(scene()))
+            customScene->registerItem(this);
+    }
     return value;
 }
 
@@ -51,6 +94,7 @@ void CustomTextItem::focusOutEvent(QFocusEvent *event)
     }
     else
     {
+        contentBeforeEdit = contentLastTime;
         contentLastTime = toPlainText();
         contentHasChanged = true;
     }
@@ -18,10 +18,15 @@ public:
     enum { Type = UserType + 3 };
 
     CustomTextItem(QGraphicsItem *parent = nullptr);
+    ~CustomTextItem();
 
     int type() const override { return Type; }
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
+    int id() const { return myId; }
+    void setId(int id);
     void setText(QString text) { contentLastTime = text; }
     QString getText() { return contentLastTime; }
+    QString previousText() const { return contentBeforeEdit; }
     bool contentIsUpdated() { return contentHasChanged; }
     bool positionIsUpdated() { return isMoved; }
     void setUpdated() { isMoved = false; }
@@ -45,6 +50,8 @@ protected:
 
 private:
     QString contentLastTime;
+    QString contentBeforeEdit;
+    int myId;
     QPointF positionLastTime;
      QColor myColor;
     bool isMoved = false;
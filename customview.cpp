@@ -30,39 +30,14 @@ void CustomView::keyReleaseEvent(QKeyEvent *event)
     }
 }
 
-void CustomView::mouseReleaseEvent(QMouseEvent *event)
+void CustomView::resizeEvent(QResizeEvent *event)
 {
-    QGraphicsView::mouseReleaseEvent(event);
-    bool needEmit = false;
-    foreach(QGraphicsItem* item, scene()->selectedItems())
-    {
-        if(item->type() == CustomItem::Type)
-        {
-            CustomItem *p = qgraphicsitem_cast<CustomItem*>(item);
-            if(p->isMoved)
-            {
-                needEmit = true;
-                p->isMoved = false;
-            }
-            if(p->isResized)
-            {
-                needEmit = true;
-                p->isResized = false;
-
-            }
-        }
-        else if(item->type() == CustomTextItem::Type)
-        {
-            CustomTextItem *p = qgraphicsitem_cast<CustomTextItem*>(item);
-            if(p->positionIsUpdated())
-            {
-                needEmit = true;
-                p->setUpdated();
-            }
-
-        }
-    }
-    if(needEmit)
-        emit needsUndoBackUp();
+    QGraphicsView::resizeEvent(event);
+    emit viewportChanged();
+}
 
+void CustomView::scrollContentsBy(int dx, int dy)
+{
+    QGraphicsView::scrollContentsBy(dx, dy);
+    emit viewportChanged();
 }
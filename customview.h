@@ -11,11 +11,13 @@ class CustomView: public QGraphicsView
 public:
     CustomView(QGraphicsScene *scene, QWidget *parent = nullptr);
 signals:
-    void needsUndoBackUp();
+    // the visible part of the scene moved or changed size
+    void viewportChanged();
 protected:
     void keyPressEvent(QKeyEvent* event)override;
     void keyReleaseEvent(QKeyEvent* event)override;
-    void mouseReleaseEvent(QMouseEvent* event)override;
+    void resizeEvent(QResizeEvent* event)override;
+    void scrollContentsBy(int dx, int dy)override;
 };
 
 #endif // CUSTOMVIEW_H
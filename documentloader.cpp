@@ -0,0 +1,216 @@
+#include "documentloader.h"
+#include "binarydocument.h"
+#include "compresseddocument.h"
+#include "customscene.h"
+#include "xmldocument.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutexLocker>
+#include <QtConcurrent>
+
+DocumentLoader::DocumentLoader(CustomScene *scene, QObject *parent)
+    : QObject(parent), myScene(scene)
+{
+    batchTimer.setInterval(FrameInterval);
+    connect(&batchTimer, SIGNAL(timeout()), this, SLOT(createBatch()));
+}
+
+DocumentLoader::~DocumentLoader()
+{
+    cancelRequested.store(1);
+    watcher.waitForFinished();
+}
+
+void DocumentLoader::load(const QString &fileName, const QPointF &focus)
+{
+    cancel();
+    watcher.waitForFinished();
+    cancelRequested.store(0);
+    reset();
+    myFileName = fileName;
+    myFocus = focus;
+    loading = true;
+    watcher.setFuture(QtConcurrent::run(&DocumentLoader::parse, fileName, this));
+    batchTimer.start();
+}
+
+void DocumentLoader::cancel()
+{
+    if (!loading) return;
+    cancelRequested.store(1);
+    batchTimer.stop();
+    QString fileName = myFileName;
+    reset();
+    emit cancelled(fileName);
+}
+
+void DocumentLoader::reset()
+{
+    loading = false;
+    created = 0;
+    parsed = 0;
+    pending.clear();
+    readyArrows.clear();
+    waitingArrows.clear();
+    QMutexLocker locker(&mutex);
+    incoming.clear();
+}
+
+DocumentLoader::Result DocumentLoader::parse(const QString &fileName, DocumentLoader *loader)
+{
+    if (fileName.endsWith(".dpd"))
+    {
+        BinaryDocument document;
+        if (!document.open(fileName))
+            return Result{ false, document.errorString() };
+        document.decode(loader->threadCount, [loader](QVector<ItemState> const& states) {
+            loader->handOver(states);
+            return !loader->isCancelled();
+        });
+        return Result{ true, QString() };
+    }
+    if (fileName.endsWith(".dpz"))
+    {
+        CompressedDocument document;
+        if (!document.open(fileName))
+            return Result{ false, document.errorString() };
+        // inflate the chunks nearest to the focus first
+        QMultiMap<qreal, int> nearest;
+        for (int c = 0; c < document.chunkCount(); ++c)
+        {
+            QPointF offset = document.chunkBounds(c).center() - loader->myFocus;
+            nearest.insert(offset.x() * offset.x() + offset.y() * offset.y(), c);
+        }
+        document.decode(nearest.values().toVector(), loader->threadCount, [loader](QVector<ItemState> const& states) {
+            loader->handOver(states);
+            return !loader->isCancelled();
+        });
+        return Result{ true, QString() };
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return Result{ false, file.errorString() };
+
+    Result result = { true, QString() };
+    QVector<ItemState> chunk;
+    chunk.reserve(ChunkSize);
+    XmlDocumentReader reader(&file);
+    ItemState state;
+    while (!loader->isCancelled() && reader.readItem(&state))
+    {
+        chunk.append(state);
+        if (chunk.size() == ChunkSize)
+        {
+            loader->handOver(chunk);
+            chunk.clear();
+        }
+    }
+    if (reader.hasError())
+        result = Result{ false, reader.errorString() };
+    loader->handOver(chunk);
+    return result;
+}
+
+void DocumentLoader::handOver(const QVector<ItemState> &states)
+{
+    QMutexLocker locker(&mutex);
+    incoming += states;
+}
+
+void DocumentLoader::takeIncoming()
+{
+    QVector<ItemState> states;
+    {
+        QMutexLocker locker(&mutex);
+        states.swap(incoming);
+    }
+    parsed += states.size();
+    foreach (ItemState const& state, states)
+    {
+        if (state.kind == ItemState::Connector)
+        {
+            readyArrows.append(state);
+            continue;
+        }
+        QPointF offset = state.pos - myFocus;
+        pending.insert(offset.x() * offset.x() + offset.y() * offset.y(), state);
+    }
+}
+
+void DocumentLoader::create(const ItemState &state)
+{
+    if (state.kind == ItemState::Connector)
+    {
+        // park the arrow on an endpoint that does not exist yet
+        if (myScene->itemById(state.startId) == nullptr)
+        {
+            waitingArrows.insert(state.startId, state);
+            return;
+        }
+        if (myScene->itemById(state.endId) == nullptr)
+        {
+            waitingArrows.insert(state.endId, state);
+            return;
+        }
+    }
+
+    myScene->createItem(state);
+    created++;
+    if (state.kind == ItemState::Shape)
+    {
+        foreach (ItemState const& arrow, waitingArrows.values(state.id))
+            readyArrows.append(arrow);
+        waitingArrows.remove(state.id);
+    }
+}
+
+void DocumentLoader::createBatch()
+{
+    QElapsedTimer timer;
+    timer.start();
+    takeIncoming();
+
+    while (timer.elapsed() < FrameBudget)
+    {
+        if (!readyArrows.isEmpty())
+        {
+            create(readyArrows.takeLast());
+        }
+        else if (!pending.isEmpty())
+        {
+            create(pending.first());
+            pending.erase(pending.begin());
+        }
+        else
+        {
+            break;
+        }
+    }
+    emit progress(created, parsed);
+
+    if (watcher.isFinished() && pending.isEmpty() && readyArrows.isEmpty())
+    {
+        // the worker may have handed over its last chunk after we looked
+        QMutexLocker locker(&mutex);
+        if (incoming.isEmpty())
+        {
+            locker.unlock();
+            finish();
+        }
+    }
+}
+
+void DocumentLoader::finish()
+{
+    batchTimer.stop();
+    if (!waitingArrows.isEmpty())
+        qDebug() << "dropped" << waitingArrows.size() << "arrows with missing endpoints";
+    Result result = watcher.result();
+    QString fileName = myFileName;
+    qDebug() << "loaded" << fileName << created << "items";
+    reset();
+    emit finished(fileName, result.ok, result.errorString);
+}
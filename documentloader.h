@@ -0,0 +1,88 @@
+#ifndef DOCUMENTLOADER_H
+#define DOCUMENTLOADER_H
+
+#include "itemstate.h"
+
+#include <QAtomicInt>
+#include <QFutureWatcher>
+#include <QMultiHash>
+#include <QMultiMap>
+#include <QMutex>
+#include <QObject>
+#include <QPointF>
+#include <QTimer>
+#include <QVector>
+
+class CustomScene;
+
+// Loads documents progressively. A worker parses the file and hands the
+// item states over in chunks; the GUI thread creates items from a timer,
+// a frame budget at a time, nearest to the focus point first, so the
+// visible part of the diagram shows up early and the UI keeps responding.
+// Arrows are created as soon as both of their endpoints exist.
+class DocumentLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DocumentLoader(CustomScene *scene, QObject *parent = nullptr);
+    ~DocumentLoader();
+
+    void load(const QString &fileName, const QPointF &focus);
+    bool isLoading() const { return loading; }
+
+    // threads decoding binary documents; XML is read by a single thread
+    void setThreadCount(int count) { threadCount = qMax(1, count); }
+
+public slots:
+    void cancel();
+
+signals:
+    void progress(int done, int total);
+    void finished(const QString &fileName, bool ok, const QString &errorString);
+    void cancelled(const QString &fileName);
+
+private slots:
+    void createBatch();
+
+private:
+    struct Result
+    {
+        bool ok;
+        QString errorString;
+    };
+
+    static Result parse(const QString &fileName, DocumentLoader *loader);
+    void handOver(QVector<ItemState> const& states);
+    bool isCancelled() const { return cancelRequested.load() != 0; }
+
+    void takeIncoming();
+    void create(ItemState const& state);
+    void finish();
+    void reset();
+
+    CustomScene *myScene;
+    QString myFileName;
+    QPointF myFocus;
+    bool loading = false;
+    int threadCount = 1;
+    int created = 0;
+    int parsed = 0;
+
+    // shared with the worker
+    QMutex mutex;
+    QVector<ItemState> incoming;
+    QAtomicInt cancelRequested;
+
+    QFutureWatcher<Result> watcher;
+    QTimer batchTimer;
+    QMultiMap<qreal, ItemState> pending;      // by distance to the focus
+    QVector<ItemState> readyArrows;
+    QMultiHash<int, ItemState> waitingArrows; // by a missing endpoint id
+
+    static const int ChunkSize = 1024;
+    static const int FrameInterval = 16;
+    static const int FrameBudget = 10;
+};
+
+#endif // DOCUMENTLOADER_H
@@ -0,0 +1,181 @@
+#include "documentsaver.h"
+#include "binarydocument.h"
+#include "compresseddocument.h"
+#include "xmldocument.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSaveFile>
+#include <QtConcurrent>
+
+DocumentSaver::DocumentSaver(QObject *parent)
+    : QObject(parent)
+{
+    connect(&watcher, SIGNAL(finished()), this, SLOT(saveFinished()));
+}
+
+DocumentSaver::~DocumentSaver()
+{
+    // queued saves still go to disk, but nobody is left to tell
+    blockSignals(true);
+    waitForFinished();
+}
+
+void DocumentSaver::save(const QString &fileName, const QVector<ItemState> &snapshot)
+{
+    Job job = { fileName, Full, snapshot, QVector<int>(), snapshot.size() };
+    enqueue(job);
+}
+
+void DocumentSaver::saveChanges(const QString &fileName, const QVector<ItemState> &changed,
+                                const QVector<int> &removedIds, int liveCount)
+{
+    Job job = { fileName, Incremental, changed, removedIds, liveCount };
+    enqueue(job);
+}
+
+void DocumentSaver::enqueue(const Job &job)
+{
+    jobs.append(job);
+    if (!isRunning)
+        start();
+}
+
+void DocumentSaver::waitForFinished()
+{
+    while (isRunning || !jobs.isEmpty())
+    {
+        if (!isRunning)
+            start();
+        watcher.waitForFinished();
+        saveFinished();
+    }
+}
+
+void DocumentSaver::start()
+{
+    running = jobs.takeFirst();
+    isRunning = true;
+    watcher.setFuture(QtConcurrent::run(&DocumentSaver::run, running, this));
+}
+
+void DocumentSaver::saveFinished()
+{
+    // waitForFinished() may already have reported this run
+    if (!isRunning || !watcher.isFinished())
+        return;
+    Result result = watcher.result();
+    Job job = running;
+    running = Job();
+    isRunning = false;
+    emit finished(job.fileName, job.mode, result.ok, result.errorString);
+    if (!isRunning && !jobs.isEmpty())
+        start();
+}
+
+DocumentSaver::Result DocumentSaver::run(const Job &job, DocumentSaver *saver)
+{
+    QElapsedTimer timer;
+    timer.start();
+    Result result = job.mode == Full ? writeFull(job.fileName, job.states, saver) : writeChanges(job);
+    if (result.ok)
+    {
+        qDebug() << "saved" << job.fileName << job.states.size() << "items"
+                 << (job.mode == Full ? "in full" : "incrementally") << "in" << timer.elapsed() << "ms";
+    }
+    return result;
+}
+
+DocumentSaver::Result DocumentSaver::writeFull(const QString &fileName, const QVector<ItemState> &states,
+                                               DocumentSaver *saver)
+{
+    Result result = { false, QString() };
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        result.errorString = file.errorString();
+        return result;
+    }
+    if (!write(&file, fileName, states, &result.errorString, saver))
+    {
+        file.cancelWriting();
+        return result;
+    }
+    if (!file.commit())
+    {
+        result.errorString = file.errorString();
+        return result;
+    }
+    result.ok = true;
+    return result;
+}
+
+DocumentSaver::Result DocumentSaver::writeChanges(const Job &job)
+{
+    Result result = { false, QString() };
+    qint64 records = 0;
+    if (!BinaryDocument::append(job.fileName, job.states, job.removedIds, &records, &result.errorString))
+        return result;
+    result.ok = true;
+
+    qint64 dead = records - job.liveCount;
+    if (dead < CompactionMinimum || dead * 100 < records * CompactionPercent)
+        return result;
+
+    // rewrite the live records into a single segment
+    QElapsedTimer timer;
+    timer.start();
+    QVector<ItemState> states;
+    {
+        BinaryDocument document;
+        if (!document.open(job.fileName))
+        {
+            qDebug() << "cannot compact" << job.fileName << ":" << document.errorString();
+            return result;
+        }
+        states = document.states();
+    }
+    Result compacted = writeFull(job.fileName, states, nullptr);
+    if (compacted.ok)
+        qDebug() << "compacted" << job.fileName << "from" << records << "to" << states.size() << "records in" << timer.elapsed() << "ms";
+    else
+        qDebug() << "cannot compact" << job.fileName << ":" << compacted.errorString;
+    return result;
+}
+
+bool DocumentSaver::write(QIODevice *device, const QString &fileName, const QVector<ItemState> &snapshot,
+                          QString *errorString, DocumentSaver *saver)
+{
+    int total = snapshot.size();
+    if (fileName.endsWith(".dpd"))
+    {
+        bool ok = BinaryDocument::write(device, snapshot, errorString);
+        if (saver)
+            emit saver->progress(total, total);
+        return ok;
+    }
+    if (fileName.endsWith(".dpz"))
+    {
+        bool ok = CompressedDocument::write(device, snapshot, errorString);
+        if (saver)
+            emit saver->progress(total, total);
+        return ok;
+    }
+
+    XmlDocumentWriter writer(device);
+    for (int i = 0; i < total; ++i)
+    {
+        writer.writeItem(snapshot.at(i));
+        if (saver && i % ProgressInterval == 0)
+            emit saver->progress(i, total);
+    }
+    if (!writer.finish())
+    {
+        if (errorString)
+            *errorString = device->errorString();
+        return false;
+    }
+    if (saver)
+        emit saver->progress(total, total);
+    return true;
+}
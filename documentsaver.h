@@ -0,0 +1,79 @@
+#ifndef DOCUMENTSAVER_H
+#define DOCUMENTSAVER_H
+
+#include "itemstate.h"
+
+#include <QFutureWatcher>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+class QIODevice;
+
+// Saves documents off the GUI thread. The caller hands over a snapshot of
+// the scene (plain ItemStates, so the scene can keep changing) and a
+// worker writes it. Full saves go through QSaveFile, which only replaces
+// the target once everything is on disk; incremental saves append the
+// changed items to a binary document and compact it once too much of it
+// is dead. Saves requested while one is running are queued in order.
+class DocumentSaver : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Mode { Full, Incremental };
+
+    explicit DocumentSaver(QObject *parent = nullptr);
+    ~DocumentSaver();
+
+    void save(const QString &fileName, QVector<ItemState> const& snapshot);
+    void saveChanges(const QString &fileName, QVector<ItemState> const& changed,
+                     QVector<int> const& removedIds, int liveCount);
+    bool isSaving() const { return watcher.isRunning() || !jobs.isEmpty(); }
+    void waitForFinished();
+
+    static bool write(QIODevice *device, const QString &fileName, QVector<ItemState> const& snapshot,
+                      QString *errorString = nullptr, DocumentSaver *progress = nullptr);
+
+signals:
+    void progress(int done, int total);
+    void finished(const QString &fileName, int mode, bool ok, const QString &errorString);
+
+private slots:
+    void saveFinished();
+
+private:
+    struct Job
+    {
+        QString fileName;
+        Mode mode;
+        QVector<ItemState> states;
+        QVector<int> removedIds;
+        int liveCount;
+    };
+
+    struct Result
+    {
+        bool ok;
+        QString errorString;
+    };
+
+    void enqueue(Job const& job);
+    void start();
+    static Result run(Job const& job, DocumentSaver *saver);
+    static Result writeFull(const QString &fileName, QVector<ItemState> const& states, DocumentSaver *saver);
+    static Result writeChanges(Job const& job);
+
+    QFutureWatcher<Result> watcher;
+    QList<Job> jobs;
+    Job running;
+    bool isRunning = false;
+
+    static const int ProgressInterval = 1000;
+    // compact once more than this share of the records is dead
+    static const int CompactionPercent = 50;
+    static const int CompactionMinimum = 256;
+};
+
+#endif // DOCUMENTSAVER_H
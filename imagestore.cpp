@@ -0,0 +1,121 @@
+#include "imagestore.h"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QImage>
+#include <QMutexLocker>
+
+QMutex ImageStore::mutex;
+QHash<QByteArray, QByteArray> ImageStore::encodedImages;
+QHash<QByteArray, QPixmap> ImageStore::decodedImages;
+QHash<QByteArray, int> ImageStore::references;
+
+namespace {
+
+// hash the pixels, not an encoding of them
+QByteArray pixelHash(const QImage &source)
+{
+    QImage image = source.convertToFormat(QImage::Format_ARGB32);
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    qint32 size[2] = { image.width(), image.height() };
+    hash.addData(reinterpret_cast<const char*>(size), sizeof(size));
+    for (int y = 0; y < image.height(); ++y)
+        hash.addData(reinterpret_cast<const char*>(image.constScanLine(y)), image.width() * 4);
+    return hash.result();
+}
+
+}
+
+QByteArray ImageStore::insert(const QPixmap &pixmap)
+{
+    QImage image = pixmap.toImage().convertToFormat(QImage::Format_ARGB32);
+    QByteArray key = pixelHash(image);
+
+    if (!contains(key))
+    {
+        QByteArray data;
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "PNG");
+        store(key, data);
+    }
+    if (!decodedImages.contains(key))
+        decodedImages.insert(key, pixmap);
+    return key;
+}
+
+bool ImageStore::insertEncoded(const QByteArray &key, const QByteArray &data)
+{
+    if (contains(key))
+        return true;
+    // files and journals are not trusted to pair the two up
+    QImage image;
+    if (key.size() != KeySize || !image.loadFromData(data, "PNG") || pixelHash(image) != key)
+    {
+        qDebug() << "image does not match its key" << key.toHex();
+        return false;
+    }
+    store(key, data);
+    return true;
+}
+
+void ImageStore::store(const QByteArray &key, const QByteArray &data)
+{
+    QMutexLocker locker(&mutex);
+    if (!encodedImages.contains(key))
+        encodedImages.insert(key, data);
+}
+
+bool ImageStore::contains(const QByteArray &key)
+{
+    QMutexLocker locker(&mutex);
+    return encodedImages.contains(key);
+}
+
+QByteArray ImageStore::encoded(const QByteArray &key)
+{
+    QMutexLocker locker(&mutex);
+    return encodedImages.value(key);
+}
+
+QPixmap ImageStore::pixmap(const QByteArray &key)
+{
+    QHash<QByteArray, QPixmap>::const_iterator it = decodedImages.constFind(key);
+    if (it != decodedImages.constEnd())
+        return it.value();
+
+    QPixmap pixmap;
+    if (!pixmap.loadFromData(encoded(key), "PNG"))
+        qDebug() << "missing image" << key.toHex();
+    decodedImages.insert(key, pixmap);
+    return pixmap;
+}
+
+void ImageStore::retain(const QByteArray &key)
+{
+    if (key.isEmpty())
+        return;
+    QMutexLocker locker(&mutex);
+    references[key]++;
+}
+
+void ImageStore::release(const QByteArray &key)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QByteArray, int>::iterator it = references.find(key);
+    if (it == references.end() || --it.value() > 0)
+        return;
+    references.erase(it);
+    encodedImages.remove(key);
+    decodedImages.remove(key);
+}
+
+void ImageStore::clear()
+{
+    // pixmaps must go before the application object does
+    decodedImages.clear();
+    QMutexLocker locker(&mutex);
+    encodedImages.clear();
+    references.clear();
+}
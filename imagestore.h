@@ -0,0 +1,41 @@
+#ifndef IMAGESTORE_H
+#define IMAGESTORE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QPixmap>
+
+// Process-wide store of the images shown by pixmap items, keyed by a SHA-1
+// of their pixels. Each distinct image is kept once, encoded as PNG for
+// the document files and decoded on first use for drawing; items only
+// hold the key, so a thousand identical sprites share one QPixmap.
+// An encoded image is only taken under the key its pixels hash to.
+// Items, undo steps and the paged document retain the keys they show
+// and release them when done; an image nobody retains is evicted.
+// The encoded side may be used from any thread, pixmap(), retain() and
+// release() only from the GUI thread.
+class ImageStore
+{
+public:
+    static const int KeySize = 20;
+
+    static QByteArray insert(const QPixmap &pixmap);
+    static bool insertEncoded(const QByteArray &key, const QByteArray &data);
+    static bool contains(const QByteArray &key);
+    static QByteArray encoded(const QByteArray &key);
+    static QPixmap pixmap(const QByteArray &key);
+    static void retain(const QByteArray &key);
+    static void release(const QByteArray &key);
+    static void clear();
+
+private:
+    static void store(const QByteArray &key, const QByteArray &data);
+
+    static QMutex mutex;
+    static QHash<QByteArray, QByteArray> encodedImages;
+    static QHash<QByteArray, QPixmap> decodedImages;
+    static QHash<QByteArray, int> references;
+};
+
+#endif // IMAGESTORE_H
@@ -0,0 +1,316 @@
+#include "itemstate.h"
+#include "arrow.h"
+#include "customitem.h"
+#include "custompixmapitem.h"
+#include "customtextitem.h"
+
+#include <QDataStream>
+#include <QGraphicsItem>
+
+int ItemState::idCounter = 0;
+
+ItemState ItemState::capture(QGraphicsItem *item, int fields)
+{
+    ItemState state;
+    state.fields = fields;
+
+    switch (item->type()) {
+    case CustomItem::Type:
+    {
+        CustomItem *p = qgraphicsitem_cast<CustomItem*>(item);
+        state.kind = Shape;
+        state.id = p->id();
+        state.customType = p->customType();
+        if (fields & Position)
+            state.pos = p->pos();
+        if (fields & Geometry)
+            state.polygon = p->polygon();
+        if ((fields & Style) && p->brush().style() != Qt::NoBrush)
+            state.color = p->brush().color();
+        if (fields & Content)
+            state.text = p->mainLabelText();
+        if (fields & Stacking)
+            state.z = p->zValue();
+        break;
+    }
+    case Arrow::Type:
+    {
+        Arrow *p = qgraphicsitem_cast<Arrow*>(item);
+        state.kind = Connector;
+        state.id = p->id();
+        // informational only: where the drawn line starts
+        if (fields & Position)
+            state.pos = p->line().p1();
+        if (fields & Geometry)
+            state.polygon = p->route();
+        if (fields & Style)
+            state.color = p->getColor();
+        if (fields & Links)
+        {
+            state.startId = p->startItem()->id();
+            state.endId = p->endItem()->id();
+        }
+        if (fields & Stacking)
+            state.z = p->zValue();
+        break;
+    }
+    case CustomTextItem::Type:
+    {
+        CustomTextItem *p = qgraphicsitem_cast<CustomTextItem*>(item);
+        state.kind = Text;
+        state.id = p->id();
+        if (fields & Position)
+            state.pos = p->pos();
+        if (fields & Style)
+        {
+            state.color = p->defaultTextColor();
+            state.font = p->font();
+        }
+        if (fields & Content)
+            state.text = p->toPlainText();
+        if (fields & Stacking)
+            state.z = p->zValue();
+        break;
+    }
+    case CustomPixmapItem::Type:
+    {
+        CustomPixmapItem *p = qgraphicsitem_cast<CustomPixmapItem*>(item);
+        state.kind = Pixmap;
+        state.id = p->id();
+        if (fields & Position)
+            state.pos = p->pos();
+        if (fields & Content)
+            state.image = p->imageKey();
+        if (fields & Stacking)
+            state.z = p->zValue();
+        break;
+    }
+    default:
+        state.fields = 0;
+        break;
+    }
+    return state;
+}
+
+int ItemState::applyTo(QGraphicsItem *item) const
+{
+    // only touch what differs, so unchanged items keep their caches
+    int changed = 0;
+    switch (kind) {
+    case Shape:
+    {
+        CustomItem *p = qgraphicsitem_cast<CustomItem*>(item);
+        if (!p) return 0;
+        if ((fields & Geometry) && polygon != p->polygon())
+        {
+            p->setShapePolygon(polygon);
+            changed |= Geometry;
+        }
+        if ((fields & Position) && pos != p->pos())
+        {
+            p->setPos(pos);
+            changed |= Position;
+        }
+        if (fields & Style)
+        {
+            QBrush brush = color.isValid() ? QBrush(color) : QBrush(Qt::NoBrush);
+            if (brush != p->brush())
+            {
+                p->setBrush(brush);
+                changed |= Style;
+            }
+        }
+        if ((fields & Content) && text != p->mainLabelText())
+        {
+            p->setMainLabelText(text);
+            changed |= Content;
+        }
+        if ((fields & Stacking) && z != p->zValue())
+        {
+            p->setZValue(z);
+            changed |= Stacking;
+        }
+        break;
+    }
+    case Connector:
+    {
+        Arrow *p = qgraphicsitem_cast<Arrow*>(item);
+        if (!p) return 0;
+        if ((fields & Geometry) && polygon != p->route())
+        {
+            p->setRoute(polygon);
+            changed |= Geometry;
+        }
+        if ((fields & Style) && color != p->getColor())
+        {
+            p->setColor(color);
+            p->update();
+            changed |= Style;
+        }
+        if ((fields & Stacking) && z != p->zValue())
+        {
+            p->setZValue(z);
+            changed |= Stacking;
+        }
+        break;
+    }
+    case Text:
+    {
+        CustomTextItem *p = qgraphicsitem_cast<CustomTextItem*>(item);
+        if (!p) return 0;
+        if ((fields & Position) && pos != p->pos())
+        {
+            p->setPos(pos);
+            changed |= Position;
+        }
+        if ((fields & Style) && (color != p->defaultTextColor() || font != p->font()))
+        {
+            p->setDefaultTextColor(color);
+            p->setFont(font);
+            changed |= Style;
+        }
+        if ((fields & Content) && text != p->toPlainText())
+        {
+            p->setPlainText(text);
+            p->setText(text);
+            changed |= Content;
+        }
+        if ((fields & Stacking) && z != p->zValue())
+        {
+            p->setZValue(z);
+            changed |= Stacking;
+        }
+        break;
+    }
+    case Pixmap:
+    {
+        CustomPixmapItem *p = qgraphicsitem_cast<CustomPixmapItem*>(item);
+        if (!p) return 0;
+        if ((fields & Position) && pos != p->pos())
+        {
+            p->setPos(pos);
+            changed |= Position;
+        }
+        if ((fields & Content) && image != p->imageKey())
+        {
+            p->setImageKey(image);
+            changed |= Content;
+        }
+        if ((fields & Stacking) && z != p->zValue())
+        {
+            p->setZValue(z);
+            changed |= Stacking;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return changed;
+}
+
+qint64 ItemState::byteSize() const
+{
+    qint64 size = sizeof(ItemState);
+    size += polygon.size() * qint64(sizeof(QPointF));
+    size += text.size() * qint64(sizeof(QChar));
+    size += image.size();
+    if (kind == Text && (fields & Style))
+        size += font.family().size() * qint64(sizeof(QChar));
+    return size;
+}
+
+int ItemState::itemId(const QGraphicsItem *item)
+{
+    switch (item->type()) {
+    case CustomItem::Type: return qgraphicsitem_cast<const CustomItem*>(item)->id();
+    case Arrow::Type: return qgraphicsitem_cast<const Arrow*>(item)->id();
+    case CustomTextItem::Type: return qgraphicsitem_cast<const CustomTextItem*>(item)->id();
+    case CustomPixmapItem::Type: return qgraphicsitem_cast<const CustomPixmapItem*>(item)->id();
+    default: return -1;
+    }
+}
+
+int ItemState::allocateId()
+{
+    return idCounter++;
+}
+
+void ItemState::reserveId(int id)
+{
+    if (id >= idCounter)
+        idCounter = id + 1;
+}
+
+// Only the captured fields are written, so a move costs a few bytes.
+QDataStream &operator<<(QDataStream &out, const ItemState &state)
+{
+    out << qint8(state.kind) << qint32(state.id) << quint8(state.fields)
+        << qint8(state.customType);
+    if (state.fields & ItemState::Position)
+        out << state.pos;
+    if (state.fields & ItemState::Geometry)
+        out << state.polygon;
+    if (state.fields & ItemState::Style)
+    {
+        out << state.color;
+        if (state.kind == ItemState::Text)
+            out << state.font;
+    }
+    if (state.fields & ItemState::Content)
+    {
+        if (state.kind == ItemState::Pixmap)
+            out << state.image;
+        else
+            out << state.text;
+    }
+    if (state.fields & ItemState::Links)
+        out << qint32(state.startId) << qint32(state.endId);
+    if (state.fields & ItemState::Stacking)
+        out << double(state.z);
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, ItemState &state)
+{
+    qint8 kind, customType;
+    qint32 id;
+    quint8 fields;
+    in >> kind >> id >> fields >> customType;
+    state = ItemState();
+    state.kind = kind;
+    state.id = id;
+    state.fields = fields;
+    state.customType = customType;
+    if (state.fields & ItemState::Position)
+        in >> state.pos;
+    if (state.fields & ItemState::Geometry)
+        in >> state.polygon;
+    if (state.fields & ItemState::Style)
+    {
+        in >> state.color;
+        if (state.kind == ItemState::Text)
+            in >> state.font;
+    }
+    if (state.fields & ItemState::Content)
+    {
+        if (state.kind == ItemState::Pixmap)
+            in >> state.image;
+        else
+            in >> state.text;
+    }
+    if (state.fields & ItemState::Links)
+    {
+        qint32 startId, endId;
+        in >> startId >> endId;
+        state.startId = startId;
+        state.endId = endId;
+    }
+    if (state.fields & ItemState::Stacking)
+    {
+        double z;
+        in >> z;
+        state.z = z;
+    }
+    return in;
+}
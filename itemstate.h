@@ -0,0 +1,63 @@
+#ifndef ITEMSTATE_H
+#define ITEMSTATE_H
+
+#include <QByteArray>
+#include <QColor>
+#include <QFont>
+#include <QPointF>
+#include <QPolygonF>
+#include <QString>
+
+class QDataStream;
+class QGraphicsItem;
+
+// Plain value description of one scene item, addressed by its stable id.
+// Undo commands keep these instead of cloned QGraphicsItems, and only the
+// fields named in `fields` are captured and applied.
+struct ItemState
+{
+    enum Kind { Invalid = 0, Shape, Connector, Text, Pixmap };
+
+    enum Field {
+        Position  = 0x01,
+        Geometry  = 0x02,
+        Style     = 0x04,
+        Content   = 0x08,
+        Links     = 0x10,
+        Stacking  = 0x20,
+        AllFields = 0xff
+    };
+
+    int kind = Invalid;
+    int id = -1;
+    int fields = 0;
+
+    int customType = 0;
+    QPointF pos;
+    qreal z = 0;
+    QPolygonF polygon;      // a shape's outline, an arrow's route
+    QColor color;
+    QString text;
+    QByteArray image;       // ImageStore key
+    QFont font;
+    int startId = -1;
+    int endId = -1;
+
+    bool isValid() const { return kind != Invalid; }
+    qint64 byteSize() const;
+
+    static ItemState capture(QGraphicsItem *item, int fields = AllFields);
+    int applyTo(QGraphicsItem *item) const;
+
+    static int itemId(const QGraphicsItem *item);
+    static int allocateId();
+    static void reserveId(int id);
+
+private:
+    static int idCounter;
+};
+
+QDataStream &operator<<(QDataStream &out, ItemState const& state);
+QDataStream &operator>>(QDataStream &in, ItemState &state);
+
+#endif // ITEMSTATE_H
@@ -0,0 +1,58 @@
+#include "levelofdetail.h"
+
+#include <QGraphicsTextItem>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QTextBlock>
+#include <QTextDocument>
+#include <QTextLayout>
+
+qreal LevelOfDetail::simplifiedBelow = LevelOfDetail::DefaultSimplified;
+qreal LevelOfDetail::sketchBelow = LevelOfDetail::DefaultSketch;
+qreal LevelOfDetail::boxesBelow = LevelOfDetail::DefaultBoxes;
+
+void LevelOfDetail::setThresholds(qreal simplified, qreal sketch, qreal boxes)
+{
+    simplifiedBelow = qMax(qreal(0), simplified);
+    sketchBelow = qBound(qreal(0), sketch, simplifiedBelow);
+    boxesBelow = qBound(qreal(0), boxes, sketchBelow);
+}
+
+LevelOfDetail::Tier LevelOfDetail::tier(const QPainter *painter)
+{
+    qreal lod = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    if (lod < boxesBelow)
+        return Boxes;
+    if (lod < sketchBelow)
+        return Sketch;
+    if (lod < simplifiedBelow)
+        return Simplified;
+    return Full;
+}
+
+bool LevelOfDetail::drawTextPlaceholder(const QGraphicsTextItem *item, QPainter *painter)
+{
+    Tier detail = tier(painter);
+    if (detail < Sketch)
+        return false;
+    if (detail == Boxes)
+        return true;
+
+    // the lines as the document laid them out when the text was set, so
+    // nothing is laid out or shaped here
+    QColor color = item->defaultTextColor();
+    color.setAlpha(color.alpha() / 3);
+    for (QTextBlock block = item->document()->begin(); block.isValid(); block = block.next())
+    {
+        QTextLayout *layout = block.layout();
+        if (layout == nullptr) continue;
+        for (int i = 0; i < layout->lineCount(); ++i)
+        {
+            QRectF rect = layout->lineAt(i).naturalTextRect().translated(layout->position());
+            if (rect.width() <= 0) continue;
+            rect.adjust(0, rect.height() / 4, 0, -rect.height() / 4);
+            painter->fillRect(rect, color);
+        }
+    }
+    return true;
+}
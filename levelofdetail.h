@@ -0,0 +1,43 @@
+#ifndef LEVELOFDETAIL_H
+#define LEVELOFDETAIL_H
+
+#include <QtGlobal>
+
+class QGraphicsTextItem;
+class QPainter;
+
+// How much of an item is worth drawing at the current zoom. The level of
+// detail is QStyleOptionGraphicsItem::levelOfDetailFromTransform of the
+// painter, 1 at 100%, and each tier starts below its threshold:
+//
+//   Full        everything, antialiased
+//   Simplified  no antialiasing, no resize handles, arrows as hairlines
+//               without their end circles
+//   Sketch      outlines as hairlines, text as a bar per line
+//   Boxes       shapes as filled boxes, no text
+//
+// The thresholds are shared by every scene and read from the settings.
+class LevelOfDetail
+{
+public:
+    enum Tier { Full, Simplified, Sketch, Boxes };
+
+    static constexpr qreal DefaultSimplified = 0.6;
+    static constexpr qreal DefaultSketch = 0.35;
+    static constexpr qreal DefaultBoxes = 0.12;
+
+    // a threshold above the one before it is lowered to it
+    static void setThresholds(qreal simplified, qreal sketch, qreal boxes);
+    static Tier tier(QPainter const *painter);
+
+    // Draws the text of item as bars, or nothing, if the tier asks for
+    // less than the text itself. Returns false if the text is to be drawn.
+    static bool drawTextPlaceholder(QGraphicsTextItem const *item, QPainter *painter);
+
+private:
+    static qreal simplifiedBelow;
+    static qreal sketchBelow;
+    static qreal boxesBelow;
+};
+
+#endif // LEVELOFDETAIL_H
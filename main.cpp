@@ -1,3 +1,4 @@
+#include "imagestore.h"
 #include "mainwindow.h"
 
 #include <QApplication>
@@ -5,7 +6,12 @@
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
-    MainWindow w;
-    w.show();
-    return a.exec();
+    int result;
+    {
+        MainWindow w;
+        w.show();
+        result = a.exec();
+    }
+    ImageStore::clear();
+    return result;
 }
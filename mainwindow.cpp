@@ -1,13 +1,48 @@
 #include "arrow.h"
+#include "binarydocument.h"
 #include "customitem.h"
+#include "custompixmapitem.h"
 #include "customscene.h"
 #include "customtextitem.h"
+#include "levelofdetail.h"
 #include "mainwindow.h"
+#include "scenepager.h"
 
-#include <QDomDocument>
 #include <QtWidgets>
 
 const int InsertTextButton = 10;
+const qint64 DefaultUndoBudgetBytes = 64 * 1024 * 1024;
+const int DefaultUndoBudgetSteps = 1000;
+const int DefaultGridPitch = 32;
+
+// where a save over the open paged document is written first
+static QString replacementFile(const QString &fileName)
+{
+    QFileInfo info(fileName);
+    return info.dir().filePath(info.completeBaseName() + ".saving." + info.suffix());
+}
+
+// A grid background whose checks or lines fall on multiples of the pitch,
+// so that snapped items sit on the grid that is shown.
+static QPixmap gridTile(const QColor &first, const QColor &second, bool lines, int pitch)
+{
+    if (lines)
+    {
+        QPixmap tile(pitch, pitch);
+        tile.fill(first);
+        QPainter painter(&tile);
+        painter.setPen(second);
+        painter.drawLine(0, 0, pitch - 1, 0);
+        painter.drawLine(0, 0, 0, pitch - 1);
+        return tile;
+    }
+    QPixmap tile(2 * pitch, 2 * pitch);
+    tile.fill(first);
+    QPainter painter(&tile);
+    painter.fillRect(pitch, 0, pitch, pitch, second);
+    painter.fillRect(0, pitch, pitch, pitch, second);
+    return tile;
+}
 
 MainWindow::MainWindow()
 {
@@ -18,10 +53,11 @@ MainWindow::MainWindow()
 
     scene = new CustomScene(itemMenu, this);
     scene->setSceneRect(QRectF(0, 0, 5000, 5000));
+    scene->setUndoSystem(&undoStack);
+    undoStack.setJournal(&journal);
+    connect(scene, SIGNAL(historyChanged()), this, SLOT(updateHistoryStatus()));
     connect(scene, SIGNAL(itemInserted(CustomItem*)),this, SLOT(itemInserted(CustomItem*)));
     connect(scene, SIGNAL(textInserted(QGraphicsTextItem*)),this, SLOT(textInserted(QGraphicsTextItem*)));
-    connect(scene, SIGNAL(arrowInserted()),this, SLOT(backupUndostack()));
-    connect(scene, SIGNAL(textChanged()), this, SLOT(backupUndostack()));
     connect(scene, SIGNAL(itemSelected(QGraphicsItem*)),this, SLOT(itemSelected(QGraphicsItem*)));
     connect(scene, SIGNAL(scaleChanging(int)),this, SLOT(sceneScaleZooming(int)));
 
@@ -30,11 +66,10 @@ MainWindow::MainWindow()
 
     QHBoxLayout *layout = new QHBoxLayout;
     layout->addWidget(toolBox);
-    view = new CustomView(scene);
+    CustomView *customView = new CustomView(scene);
+    view = customView;
     layout->addWidget(view);
 
-    connect(view, SIGNAL(needsUndoBackUp()), this, SLOT(backupUndostack()));
-
     QWidget *widget = new QWidget;
     widget->setLayout(layout);
 
@@ -42,7 +77,45 @@ MainWindow::MainWindow()
     setWindowTitle(tr("Demo Project"));
     setUnifiedTitleAndToolBarOnMac(true);
 
-    undoStack.backup(QList<QGraphicsItem*>());
+    // undo budget, tunable per workstation; 0 means unlimited
+    QSettings settings("DemoProject", "DemoProject");
+    undoStack.setMemoryBudget(settings.value("undo/maxBytes", DefaultUndoBudgetBytes).toLongLong(),
+                              settings.value("undo/maxSteps", DefaultUndoBudgetSteps).toInt());
+    scene->setGridPitch(settings.value("grid/pitch", DefaultGridPitch).toInt());
+    // zoom levels below which items draw less, 1 being 100%
+    LevelOfDetail::setThresholds(settings.value("detail/simplified", LevelOfDetail::DefaultSimplified).toDouble(),
+                                 settings.value("detail/sketch", LevelOfDetail::DefaultSketch).toDouble(),
+                                 settings.value("detail/boxes", LevelOfDetail::DefaultBoxes).toDouble());
+    connect(snapAction, SIGNAL(toggled(bool)), scene, SLOT(setSnapToGrid(bool)));
+    connect(bundleAction, SIGNAL(toggled(bool)), scene, SLOT(setBundleArrows(bool)));
+
+    historyLabel = new QLabel(this);
+    statusBar()->addPermanentWidget(historyLabel);
+    updateHistoryStatus();
+
+    saveProgressBar = new QProgressBar(this);
+    saveProgressBar->setMaximumWidth(160);
+    saveProgressBar->hide();
+    statusBar()->addPermanentWidget(saveProgressBar);
+    connect(&saver, SIGNAL(progress(int,int)), this, SLOT(saveProgress(int,int)));
+    connect(&saver, SIGNAL(finished(QString,int,bool,QString)), this, SLOT(saveFinished(QString,int,bool,QString)));
+
+    loader = new DocumentLoader(scene, this);
+    loader->setThreadCount(settings.value("load/threads", QThread::idealThreadCount()).toInt());
+    loadProgressBar = new QProgressBar(this);
+    loadProgressBar->setMaximumWidth(160);
+    loadProgressBar->hide();
+    cancelLoadButton = new QPushButton(tr("Cancel"), this);
+    cancelLoadButton->hide();
+    statusBar()->addPermanentWidget(loadProgressBar);
+    statusBar()->addPermanentWidget(cancelLoadButton);
+    connect(cancelLoadButton, SIGNAL(clicked()), loader, SLOT(cancel()));
+    connect(loader, SIGNAL(progress(int,int)), this, SLOT(loadProgress(int,int)));
+    connect(loader, SIGNAL(finished(QString,bool,QString)), this, SLOT(loadFinished(QString,bool,QString)));
+    connect(loader, SIGNAL(cancelled(QString)), this, SLOT(loadCancelled(QString)));
+
+    pager = new ScenePager(scene, customView, this);
+    scene->setPager(pager);
 }
 
 void MainWindow::backgroundButtonGroupClicked(QAbstractButton *button)
@@ -55,14 +128,20 @@ void MainWindow::backgroundButtonGroupClicked(QAbstractButton *button)
     }
     QString text = button->text();
 
+    // the grids are drawn at the snapping pitch, the icons only show them
+    int pitch = scene->gridPitch();
     if (text == tr("Blue Grid"))
-        scene->setBackgroundBrush(QPixmap(":/Icon/background1.png"));
+        scene->setBackgroundBrush(gridTile(QColor(0, 255, 255), Qt::white, false, pitch));
     else if (text == tr("White Grid"))
-        scene->setBackgroundBrush(QPixmap(":/Icon/background2.png"));
+        scene->setBackgroundBrush(gridTile(Qt::white, Qt::black, true, pitch));
     else if (text == tr("Gray Grid"))
-        scene->setBackgroundBrush(QPixmap(":/Icon/background3.png"));
+        scene->setBackgroundBrush(gridTile(Qt::white, QColor(192, 192, 192), false, pitch));
     else
         scene->setBackgroundBrush(QPixmap(":/Icon/background4.png"));
+    // snapping goes with the grids
+    snapAction->setEnabled(text != tr("No Grid"));
+    if (text == tr("No Grid"))
+        snapAction->setChecked(false);
 
     scene->update();
     view->update();
@@ -100,14 +179,22 @@ void MainWindow::buttonGroupClicked(int id)
 
 void MainWindow::newFile()
 {
+    loader->cancel();
+    pager->close();
+    journal.close();
     scene->clear();
+    scene->clearChanges();
+    scene->clearEdits();
+    baselineFile.clear();
+    undoStack.clear();
+    updateHistoryStatus();
     setCurrentFile(QString());
 
 }
 
 void MainWindow::openFile()
 {
-    QString fileName = QFileDialog::getOpenFileName(this, tr("Open File"), "", tr("XML Files (*.xml)"));
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Open File"), "", tr("Diagram Files (*.dpd *.dpz *.xml)"));
     if (fileName.isEmpty())
         return;
 
@@ -117,21 +204,75 @@ void MainWindow::openFile()
         QMessageBox::warning(this, tr("Open File"), tr("Cannot open file %1:\n%2.").arg(fileName).arg(file.errorString()));
         return;
     }
+    file.close();
 
-    if (fileName.endsWith(".xml"))
+    if (!fileName.endsWith(".xml") && !fileName.endsWith(".dpd") && !fileName.endsWith(".dpz"))
     {
-        QDomDocument doc;
-        if (!doc.setContent(&file))
+        setCurrentFile(fileName);
+        recoverJournal(fileName);
+        return;
+    }
+
+    newFile();
+    setCurrentFile(fileName);
+
+    // large compressed documents are paged in around the view instead
+    if (fileName.endsWith(".dpz") && pager->open(fileName))
+    {
+        if (pager->itemCount() >= ScenePager::Threshold)
         {
-            QMessageBox::warning(this, tr("Open File"), tr("Cannot parse file %1:\n%2.").arg(fileName).arg(file.errorString()));
+            pager->update();
+            recoverJournal(fileName);
             return;
         }
-        QDomElement root = doc.documentElement();
-        scene->loadFromXml(root);
+        pager->close();
     }
 
-    setCurrentFile(fileName);
+    setLoading(true);
+    loader->load(fileName, view->mapToScene(view->viewport()->rect().center()));
+}
 
+void MainWindow::setLoading(bool loading)
+{
+    // the view can still be scrolled and zoomed, but not edited: new items
+    // could take ids the document has not handed out yet, and saving a
+    // half-loaded document would lose the rest of it
+    view->setInteractive(!loading);
+    saveAction->setEnabled(!loading);
+    saveAsAction->setEnabled(!loading);
+    pasteAction->setEnabled(!loading);
+    loadProgressBar->setRange(0, 0);
+    loadProgressBar->setVisible(loading);
+    cancelLoadButton->setVisible(loading);
+}
+
+void MainWindow::loadProgress(int done, int total)
+{
+    loadProgressBar->setRange(0, total);
+    loadProgressBar->setValue(done);
+}
+
+void MainWindow::loadFinished(const QString &fileName, bool ok, const QString &errorString)
+{
+    setLoading(false);
+    if (!ok)
+    {
+        // keep what could be read, but never save it over the original
+        QMessageBox::warning(this, tr("Open File"), tr("Cannot parse file %1:\n%2.").arg(fileName).arg(errorString));
+        setCurrentFile(QString());
+        return;
+    }
+    scene->clearChanges();
+    if (fileName.endsWith(".dpd") && BinaryDocument::isAppendable(fileName))
+        baselineFile = fileName;
+    recoverJournal(fileName);
+}
+
+void MainWindow::loadCancelled(const QString &fileName)
+{
+    setLoading(false);
+    newFile();
+    statusBar()->showMessage(tr("Opening %1 cancelled").arg(fileName), 2000);
 }
 
 void MainWindow::save()
@@ -142,31 +283,61 @@ void MainWindow::save()
     }
     else
     {
-        QFile file(currentFile);
-        if (!file.open(QIODevice::WriteOnly))
+        // only the snapshot is taken here; writing happens on a worker
+        savedRevision = undoStack.revision();
+        if (currentFile == baselineFile)
         {
-            QMessageBox::warning(this, tr("Save File"), tr("Cannot save file %1:\n%2.").arg(currentFile).arg(file.errorString()));
-            return;
+            // the file on disk matches the last save, so appending the
+            // changes since then is enough
+            QVector<ItemState> changed;
+            QVector<int> removedIds;
+            scene->takeChanges(&changed, &removedIds);
+            saver.saveChanges(currentFile, changed, removedIds, scene->itemCount());
         }
-
-        if (currentFile.endsWith(".xml"))
+        else
         {
-            QDomDocument doc;
-            QDomElement root = doc.createElement("scene");
-            doc.appendChild(root);
-            scene->saveToXml(doc, root);
-            QTextStream stream(&file);
-            stream << doc.toString();
+            scene->clearChanges();
+            saveSnapshot(currentFile);
         }
+        statusBar()->showMessage(tr("Saving %1...").arg(currentFile));
+    }
+
+}
 
-        setCurrentFile(currentFile);
+void MainWindow::saveSnapshot(const QString &fileName)
+{
+    if (!pager->isOpen())
+    {
+        saver.save(fileName, scene->snapshot());
+        return;
     }
+    // the paged file stays mapped while the save runs, so a save over it
+    // goes next to it and replaces it once it is done
+    if (QFileInfo(fileName) == QFileInfo(pager->fileName()))
+        saver.save(replacementFile(fileName), pager->snapshot());
+    else
+        saver.save(fileName, pager->snapshot());
+}
 
+void MainWindow::recoverJournal(const QString &fileName)
+{
+    bool recovered = false;
+    journal.close();
+    if (UndoJournal::hasEntries(fileName) &&
+            QMessageBox::question(this, tr("Open File"),
+                                  tr("%1 has unsaved changes from a previous session.\nRecover them?").arg(fileName))
+            == QMessageBox::Yes)
+    {
+        recovered = UndoJournal::replay(fileName, scene, &undoStack) > 0;
+        updateHistoryStatus();
+    }
+    journal.open(fileName, recovered);
+    setWindowModified(recovered);
 }
 
 void MainWindow::saveAs()
 {
-    QString fileName = QFileDialog::getSaveFileName(this, tr("Save As File"), "", tr("XML Files (*.xml)"));
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Save As File"), "", tr("Binary Diagrams (*.dpd);;Compressed Diagrams (*.dpz);;XML Files (*.xml)"));
     if (fileName.isEmpty())
         return;
 
@@ -188,21 +359,22 @@ void MainWindow::copyItem()
 void MainWindow::pasteItem()
 {
     QList<QGraphicsItem*> pasteBoardCopy(cloneItems(pasteBoard));
-    foreach(QGraphicsItem* p, scene->items()) p->setSelected(false);
+    scene->beginTransaction(UndoCommand::Insert);
+    scene->clearSelection();
 
     foreach(QGraphicsItem* item, pasteBoard)
     {
         if (item->type() != Arrow::Type)
         {
-            item->setPos(item->scenePos() + QPointF(20, 20));
+            item->setPos(scene->snapToGrid(item->scenePos() + QPointF(20, 20)));
             item->setZValue(item->zValue() + 0.1);
         }
         scene->addItem(item);
         item->setSelected(true);
     }
+    scene->recordInsertion(UndoCommand::Insert, pasteBoard);
+    scene->commitTransaction();
     pasteBoard.swap(pasteBoardCopy);
-    if (!scene->selectedItems().empty())
-        undoStack.backup(cloneItems(scene->items()));
 }
 
 void MainWindow::cutItem()
@@ -213,47 +385,27 @@ void MainWindow::cutItem()
 
 void MainWindow::deleteItem()
 {
-    bool needsBackup = !scene->selectedItems().empty();
-    scene->deleteItems(scene->selectedItems());
-    if (needsBackup)
-        undoStack.backup(cloneItems(scene->items()));
+    QList<QGraphicsItem*> selected = scene->selectedItems();
+    if (selected.isEmpty()) return;
+
+    scene->beginTransaction(UndoCommand::Delete);
+    scene->recordDeletion(selected);
+    scene->deleteItems(selected);
+    scene->commitTransaction();
 }
 
 void MainWindow::undo()
 {
     if (undoStack.isEmpty()) return;
-
-    scene->deleteItems(scene->items());
-    QList<QGraphicsItem*> undoneItems = cloneItems(undoStack.undo());
-    foreach(QGraphicsItem* item, undoneItems)
-    {
-        qDebug() << item << "--------- add item";
-        scene->addItem(item);
-    }
-
-
-    foreach(QGraphicsItem* item, undoneItems)
-    {
-        if (item->type() == Arrow::Type)
-            qgraphicsitem_cast<Arrow*>(item)->updatePosition();
-    }
+    undoStack.undo(scene);
+    updateHistoryStatus();
 }
 
 void MainWindow::redo()
 {
     if (undoStack.isFull()) return;
-    scene->deleteItems(scene->items());
-    QList<QGraphicsItem*> redoneItems = cloneItems(undoStack.redo());
-    foreach(QGraphicsItem* item, redoneItems)
-    {
-        scene->addItem(item);
-    }
-
-    foreach(QGraphicsItem* item, redoneItems)
-    {
-        if (item->type() == Arrow::Type)
-            qgraphicsitem_cast<Arrow*>(item)->updatePosition();
-    }
+    undoStack.redo(scene);
+    updateHistoryStatus();
 }
 
 void MainWindow::groupItems()
@@ -263,7 +415,6 @@ void MainWindow::groupItems()
     group->setFlag(QGraphicsItem::ItemIsSelectable, true);
     group->setFlag(QGraphicsItem::ItemSendsGeometryChanges, true);
     scene->addItem(group);
-    backupUndostack();
 }
 
 void MainWindow::ungroupItems()
@@ -275,7 +426,6 @@ void MainWindow::ungroupItems()
             scene->destroyItemGroup(qgraphicsitem_cast<QGraphicsItemGroup*>(p));
         }
     }
-    backupUndostack();
 }
 
 void MainWindow::rectangleAreaItem()
@@ -328,10 +478,10 @@ void MainWindow::pointerGroupClicked(int)
 
 void MainWindow::bringToFront()
 {
-    if (scene->selectedItems().isEmpty())
+    if (scene->selection().isEmpty())
         return;
 
-    QGraphicsItem *selectedItem = scene->selectedItems().first();
+    QGraphicsItem *selectedItem = *scene->selection().constBegin();
     QList<QGraphicsItem *> overlapItems = selectedItem->collidingItems();
 
     qreal zValue = 0;
@@ -339,16 +489,18 @@ void MainWindow::bringToFront()
         if (item->zValue() >= zValue && item->type() == CustomItem::Type)
             zValue = item->zValue() + 0.1;
     }
+    QVector<ItemState> before;
+    before.append(ItemState::capture(selectedItem, ItemState::Stacking));
     selectedItem->setZValue(zValue);
-    backupUndostack();
+    scene->pushCommand(scene->changeCommand(UndoCommand::Restyle, before));
 }
 
 void MainWindow::sendToBack()
 {
-    if (scene->selectedItems().isEmpty())
+    if (scene->selection().isEmpty())
         return;
 
-    QGraphicsItem *selectedItem = scene->selectedItems().first();
+    QGraphicsItem *selectedItem = *scene->selection().constBegin();
     QList<QGraphicsItem *> overlapItems = selectedItem->collidingItems();
 
     qreal zValue = 0;
@@ -356,8 +508,10 @@ void MainWindow::sendToBack()
         if (item->zValue() <= zValue && item->type() == CustomItem::Type)
             zValue = item->zValue() - 0.1;
     }
+    QVector<ItemState> before;
+    before.append(ItemState::capture(selectedItem, ItemState::Stacking));
     selectedItem->setZValue(zValue);
-    backupUndostack();
+    scene->pushCommand(scene->changeCommand(UndoCommand::Restyle, before));
 }
 
 void MainWindow::itemInserted(CustomItem *item)
@@ -365,7 +519,6 @@ void MainWindow::itemInserted(CustomItem *item)
     pointerTypeGroup->button(int(CustomScene::MoveItem))->setChecked(true);
     scene->setMode(CustomScene::Mode(pointerTypeGroup->checkedId()));
     buttonGroup->button(int(item->customType()))->setChecked(false);
-    backupUndostack();
 }
 
 void MainWindow::textInserted(QGraphicsTextItem *)
@@ -374,11 +527,6 @@ void MainWindow::textInserted(QGraphicsTextItem *)
     scene->setMode(CustomScene::Mode(pointerTypeGroup->checkedId()));
 }
 
-void MainWindow::backupUndostack()
-{
-    undoStack.backup(cloneItems(scene->items()));
-}
-
 void MainWindow::currentFontChanged(const QFont &)
 {
     handleFontChange();
@@ -396,6 +544,7 @@ void MainWindow::sceneScaleChanged(const QString &scale)
     view->resetMatrix();
     view->translate(oldMatrix.dx(), oldMatrix.dy());
     view->scale(newScale, newScale);
+    pager->update();
 }
 
 void MainWindow::sceneScaleZooming(int delta)
@@ -416,7 +565,6 @@ void MainWindow::textColorChanged()
     fontColorToolButton->setIcon(createColorToolButtonIcon(":/Icon/textpointer.png",
                                                            qvariant_cast<QColor>(textAction->data())));
     textButtonTriggered();
-    undoStack.backup(cloneItems(scene->items()));
 }
 
 void MainWindow::itemColorChanged()
@@ -425,7 +573,6 @@ void MainWindow::itemColorChanged()
     fillColorToolButton->setIcon(createColorToolButtonIcon(":/Icon/floodfill.png",
                                                            qvariant_cast<QColor>(fillAction->data())));
     fillButtonTriggered();
-    undoStack.backup(cloneItems(scene->items()));
 }
 
 void MainWindow::lineColorChanged()
@@ -474,6 +621,77 @@ void MainWindow::itemSelected(QGraphicsItem *item)
     underlineAction->setChecked(font.underline());
 }
 
+void MainWindow::updateHistoryStatus()
+{
+    QString budget = undoStack.maxBytes() > 0
+            ? tr("%1 KB").arg(undoStack.maxBytes() / 1024)
+            : tr("unlimited");
+    historyLabel->setText(tr("Undo history: %1 steps, %2 KB of %3")
+                          .arg(undoStack.count())
+                          .arg(undoStack.byteSize() / 1024)
+                          .arg(budget));
+}
+
+void MainWindow::saveProgress(int done, int total)
+{
+    saveProgressBar->setRange(0, total);
+    saveProgressBar->setValue(done);
+    saveProgressBar->show();
+}
+
+void MainWindow::saveFinished(const QString &savedFile, int mode, bool ok, const QString &saveError)
+{
+    QString fileName = savedFile;
+    QString errorString = saveError;
+    if (pager->isOpen() && savedFile == replacementFile(pager->fileName()))
+    {
+        fileName = pager->fileName();
+        if (ok)
+            ok = pager->replaceFile(savedFile, &errorString);
+        else
+            QFile::remove(savedFile);
+    }
+    if (!saver.isSaving())
+        saveProgressBar->hide();
+    if (!ok && mode == DocumentSaver::Incremental)
+    {
+        // the changes are lost for the file, so write all of it instead
+        qDebug() << "incremental save failed:" << errorString;
+        if (baselineFile == fileName)
+            baselineFile.clear();
+        if (fileName == currentFile)
+        {
+            scene->clearChanges();
+            saveSnapshot(currentFile);
+        }
+        return;
+    }
+    if (!ok)
+    {
+        // the changes taken for this save never made it to disk
+        if (baselineFile == fileName)
+            baselineFile.clear();
+        statusBar()->clearMessage();
+        QMessageBox::warning(this, tr("Save File"), tr("Cannot save file %1:\n%2.").arg(fileName).arg(errorString));
+        return;
+    }
+    statusBar()->showMessage(tr("Saved %1").arg(fileName), 2000);
+
+    if (mode == DocumentSaver::Full)
+        // a paged document tracks its changes itself, so it never appends
+        baselineFile = fileName.endsWith(".dpd") && !pager->isOpen() ? fileName : QString();
+
+    // the saved file holds everything the journal had, unless the user kept
+    // editing while it was written; then there is no point to mark. The
+    // journal keeps the history before the mark for undo and redo.
+    if (fileName == currentFile && undoStack.revision() == savedRevision)
+    {
+        journal.rename(currentFile);
+        journal.recordSaved();
+        setWindowModified(false);
+    }
+}
+
 void MainWindow::about()
 {
     QMessageBox::about(this, tr("About Demo Project"), tr("A drawing tool."));
@@ -699,6 +917,17 @@ void MainWindow::createActions()
     ungroupAction->setStatusTip(tr("Ungroup graphic items"));
     connect(ungroupAction, SIGNAL(triggered()), this, SLOT(ungroupItems()));
 
+    snapAction = new QAction(tr("&Snap to Grid"), this);
+    snapAction->setCheckable(true);
+    snapAction->setShortcut(tr("Ctrl+G"));
+    snapAction->setStatusTip(tr("Place, move and resize items on the grid"));
+    // until a grid background is chosen
+    snapAction->setEnabled(false);
+
+    bundleAction = new QAction(tr("&Bundle Arrows"), this);
+    bundleAction->setCheckable(true);
+    bundleAction->setStatusTip(tr("Draw arrows between the same areas as shared bundles"));
+
     rectangleArea = new QAction (tr("&Rectangle Area"), this);
     connect(rectangleArea, SIGNAL(triggered()), this, SLOT(rectangleAreaItem()));
 
@@ -766,6 +995,8 @@ void MainWindow::createMenus()
     itemMenu->addSeparator();
     itemMenu->addAction(groupAction);
     itemMenu->addAction(ungroupAction);
+    itemMenu->addAction(snapAction);
+    itemMenu->addAction(bundleAction);
     itemMenu->addSeparator();
     itemMenu->addAction(toFrontAction);
     itemMenu->addAction(sendBackAction);
@@ -789,6 +1020,8 @@ void MainWindow::createToolbars()
     editToolBar->addAction(sendBackAction);
     editToolBar->addAction(groupAction);
     editToolBar->addAction(ungroupAction);
+    editToolBar->addAction(snapAction);
+    editToolBar->addAction(bundleAction);
     removeToolBar(editToolBar);
     addToolBar(Qt::LeftToolBarArea, editToolBar);
     editToolBar->show();
@@ -981,6 +1214,14 @@ QList<QGraphicsItem*> MainWindow::cloneItems(const QList<QGraphicsItem*>& items)
         {
             copyMap[item] = qgraphicsitem_cast<CustomTextItem*>(item)->clone();
         }
+        else if (item->type() == CustomPixmapItem::Type)
+        {
+            CustomPixmapItem *pixmapItem = qgraphicsitem_cast<CustomPixmapItem*>(item);
+            CustomPixmapItem *copy = new CustomPixmapItem(pixmapItem->imageKey());
+            copy->setPos(pixmapItem->pos());
+            copy->setZValue(pixmapItem->zValue());
+            copyMap[item] = copy;
+        }
     }
 
     // connect customitem with new arrow
@@ -5,11 +5,14 @@
 
 #include <QMainWindow>
 #include "customview.h"
-#include <QDomDocument>
 #include <memory>
 #include "undosystem.h"
+#include "undojournal.h"
+#include "documentloader.h"
+#include "documentsaver.h"
 
 class CustomScene;
+class ScenePager;
 
 #include <QAction>
 #include <QToolBox>
@@ -23,6 +26,9 @@ class CustomScene;
 #include <QToolButton>
 #include <QAbstractButton>
 #include <QGraphicsView>
+#include <QLabel>
+#include <QProgressBar>
+#include <QPushButton>
 
 class MainWindow : public QMainWindow
 {
@@ -61,7 +67,6 @@ private slots:
     void sendToBack();
     void itemInserted(CustomItem *item);
     void textInserted(QGraphicsTextItem *item);
-    void backupUndostack();
     void currentFontChanged(const QFont &font);
     void fontSizeChanged(const QString &size);
     void sceneScaleChanged(const QString &scale);
@@ -75,6 +80,12 @@ private slots:
     void lineButtonTriggered();
     void handleFontChange();
     void itemSelected(QGraphicsItem *item);
+    void updateHistoryStatus();
+    void saveProgress(int done, int total);
+    void saveFinished(const QString &savedFile, int mode, bool ok, const QString &saveError);
+    void loadProgress(int done, int total);
+    void loadFinished(const QString &fileName, bool ok, const QString &errorString);
+    void loadCancelled(const QString &fileName);
     void about();
 
 
@@ -85,6 +96,9 @@ private:
     void createToolbars();
 
     void setCurrentFile(const QString &fileName);
+    void recoverJournal(const QString &fileName);
+    void saveSnapshot(const QString &fileName);
+    void setLoading(bool loading);
     QWidget *createBackgroundCellWidget(const QString &text, const QString &image);
     QWidget *createCellWidget(const QString &text, CustomItem::CustomType type);
     QMenu *createColorMenu(const char *slot, QColor defaultColor);
@@ -99,6 +113,12 @@ private:
 
     QList<QGraphicsItem*> pasteBoard;
     UndoSystem undoStack;
+    UndoJournal journal;
+    DocumentSaver saver;
+    int savedRevision = -1;
+    QString baselineFile;    // binary file known to match the scene minus its changes
+    DocumentLoader *loader;
+    ScenePager *pager;
 
     QAction *newAction;
     QAction *openAction;
@@ -117,6 +137,8 @@ private:
     QAction *sendBackAction;
     QAction *groupAction;
     QAction *ungroupAction;
+    QAction *snapAction;
+    QAction *bundleAction;
 
     QAction *aboutAction;
 
@@ -129,6 +151,11 @@ private:
     QToolBar *colorToolBar;
     QToolBar *pointerToolbar;
 
+    QLabel *historyLabel;
+    QProgressBar *saveProgressBar;
+    QProgressBar *loadProgressBar;
+    QPushButton *cancelLoadButton;
+
     QComboBox *sceneScaleCombo;
     QComboBox *itemColorCombo;
     QComboBox *textColorCombo;
@@ -0,0 +1,30 @@
+#include "paralleldecode.h"
+
+#include <QAtomicInt>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+void decodeInParallel(int count, int threadCount, const std::function<bool(int)> &part)
+{
+    if (count <= 0)
+        return;
+
+    QAtomicInt next(0);
+    QAtomicInt stopped(0);
+    auto work = [&]() {
+        for (int i = next.fetchAndAddRelaxed(1); i < count && !stopped.load(); i = next.fetchAndAddRelaxed(1))
+        {
+            if (!part(i))
+                stopped.store(1);
+        }
+    };
+
+    // the calling thread is one of the workers
+    threadCount = qBound(1, threadCount, count);
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, threadCount - 1));
+    for (int t = 1; t < threadCount; ++t)
+        QtConcurrent::run(&pool, work);
+    work();
+    pool.waitForDone();
+}
@@ -0,0 +1,12 @@
+#ifndef PARALLELDECODE_H
+#define PARALLELDECODE_H
+
+#include <functional>
+
+// Decodes the parts 0 .. count - 1 of a document by calling part on up to
+// threadCount threads, the calling thread being one of them. Parts are
+// handed out in order as threads get free; part stops the decoding by
+// returning false.
+void decodeInParallel(int count, int threadCount, std::function<bool(int)> const& part);
+
+#endif // PARALLELDECODE_H
@@ -0,0 +1,450 @@
+#include "scenepager.h"
+#include "arrow.h"
+#include "customitem.h"
+#include "customscene.h"
+#include "customview.h"
+#include "imagestore.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QMultiMap>
+#include <QPainter>
+
+ScenePager::ScenePager(CustomScene *scene, CustomView *view, QObject *parent)
+    : QObject(parent), myScene(scene), myView(view)
+{
+    // scrolling emits a burst of changes, page once it settles
+    updateTimer.setSingleShot(true);
+    updateTimer.setInterval(UpdateDelay);
+    connect(&updateTimer, SIGNAL(timeout()), this, SLOT(pageViewport()));
+    connect(view, SIGNAL(viewportChanged()), this, SLOT(update()));
+}
+
+ScenePager::~ScenePager()
+{
+    delete document;
+}
+
+bool ScenePager::open(const QString &fileName)
+{
+    close();
+    document = new CompressedDocument;
+    if (!document->open(fileName))
+    {
+        myErrorString = document->errorString();
+        close();
+        return false;
+    }
+    // new items must not take the ids of items that are not paged in yet
+    ItemState::reserveId(document->maxId());
+    foreach (QByteArray const& key, document->imageKeys())
+        pinImage(key);
+    myScene->setSceneRect(myScene->sceneRect().united(bounds()));
+    return true;
+}
+
+bool ScenePager::replaceFile(const QString &savedFile, QString *errorString)
+{
+    QString target = document->fileName();
+    document->close();
+    bool replaced = QFile::remove(target) && QFile::rename(savedFile, target);
+    if (!replaced)
+        *errorString = tr("Cannot replace %1 with %2").arg(target).arg(savedFile);
+    // whichever of the two is left holds the document
+    if (!document->open(QFile::exists(target) ? target : savedFile))
+    {
+        *errorString = document->errorString();
+        close();
+        return false;
+    }
+    ItemState::reserveId(document->maxId());
+    foreach (QByteArray const& key, document->imageKeys())
+        pinImage(key);
+
+    // the items in the scene stay; their chunks are the new file's now,
+    // and the overrides and removals still hold, since the file has
+    // nothing newer
+    loadedChunks.clear();
+    overflow.clear();
+    overflowBounds.clear();
+    QMutableHashIterator<int, int> it(resident);
+    while (it.hasNext())
+    {
+        it.next();
+        QVector<int> chunks = document->chunksFor(QVector<int>() << it.key());
+        it.setValue(chunks.isEmpty() ? -1 : chunks.first());
+    }
+    update();
+    return replaced;
+}
+
+void ScenePager::close()
+{
+    updateTimer.stop();
+    delete document;
+    document = nullptr;
+    loadedChunks.clear();
+    resident.clear();
+    overrides.clear();
+    removedIds.clear();
+    overflow.clear();
+    overflowBounds.clear();
+    foreach (QByteArray const& key, pinnedImages)
+        ImageStore::release(key);
+    pinnedImages.clear();
+}
+
+QRectF ScenePager::bounds() const
+{
+    QRectF rect;
+    for (int chunk = 0; document && chunk < document->chunkCount(); ++chunk)
+        rect = rect.united(document->chunkBounds(chunk));
+    return rect;
+}
+
+void ScenePager::update()
+{
+    if (document)
+        updateTimer.start();
+}
+
+void ScenePager::pageViewport()
+{
+    if (!document)
+        return;
+    if (myScene->mouseGrabberItem() || myScene->inTransaction())
+    {
+        // never page under a drag
+        updateTimer.start();
+        return;
+    }
+
+    QRectF visible = myView->mapToScene(myView->viewport()->rect()).boundingRect();
+    QRectF load = visible.adjusted(-Margin, -Margin, Margin, Margin);
+    QRectF keep = load.adjusted(-Margin, -Margin, Margin, Margin);
+
+    // nearest chunks first, and no more than MaxChunks of them however far
+    // the view is zoomed out; the others in view are drawn coarsely
+    QMultiMap<qreal, int> nearest;
+    foreach (int chunk, document->chunksIn(load))
+    {
+        QPointF offset = document->chunkBounds(chunk).center() - visible.center();
+        nearest.insert(offset.x() * offset.x() + offset.y() * offset.y(), chunk);
+    }
+    QList<int> wanted = nearest.values().mid(0, MaxChunks);
+
+    QSet<int> kept = wanted.toSet();
+    foreach (int chunk, loadedChunks)
+    {
+        if (kept.size() < 2 * MaxChunks && document->chunkBounds(chunk).intersects(keep))
+            kept.insert(chunk);
+    }
+    loadedChunks.intersect(kept);
+
+    collectRemoved();
+    release(keep);
+    foreach (int chunk, wanted)
+    {
+        if (!loadedChunks.contains(chunk))
+            pageIn(chunk);
+    }
+
+    // edited items that were moved away from their own chunk, then the
+    // arrows between them
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        foreach (ItemState const& state, overrides)
+        {
+            if ((state.kind == ItemState::Connector) != (pass == 1) || myScene->itemById(state.id)) continue;
+            if (pass == 0 && !load.contains(state.pos)) continue;
+            if (pass == 1 && (!myScene->itemById(state.startId) || !myScene->itemById(state.endId))) continue;
+            create(state, -1);
+        }
+    }
+
+    QList<int> beyond;
+    foreach (int chunk, nearest.values().mid(MaxChunks))
+    {
+        if (!loadedChunks.contains(chunk) && document->chunkBounds(chunk).intersects(visible))
+            beyond.append(chunk);
+    }
+    updateOverflow(beyond);
+}
+
+void ScenePager::updateOverflow(const QList<int> &chunks)
+{
+    QHash<int, QVector<Box> > boxed;
+    foreach (int chunk, chunks.mid(0, MaxBoxedChunks))
+    {
+        if (overflow.contains(chunk))
+        {
+            boxed.insert(chunk, overflow.value(chunk));
+            continue;
+        }
+        // as CustomItem draws itself at LevelOfDetail::Boxes
+        QVector<Box> &boxes = boxed[chunk];
+        foreach (ItemState const& read, document->readChunk(chunk))
+        {
+            if (read.kind != ItemState::Shape || removedIds.contains(read.id) || myScene->itemById(read.id)) continue;
+            ItemState const& state = overrides.contains(read.id) ? overrides[read.id] : read;
+            Box box;
+            box.rect = state.polygon.boundingRect().translated(state.pos);
+            box.color = state.color.isValid() ? state.color : QColor(Qt::black);
+            boxes.append(box);
+        }
+    }
+    QVector<QRectF> bounds;
+    foreach (int chunk, chunks.mid(MaxBoxedChunks))
+        bounds.append(document->chunkBounds(chunk));
+
+    bool changed = boxed.keys().toSet() != overflow.keys().toSet() || bounds != overflowBounds;
+    overflow = boxed;
+    overflowBounds = bounds;
+    if (changed)
+        myScene->update();
+}
+
+void ScenePager::drawOverflow(QPainter *painter, const QRectF &rect) const
+{
+    for (QHash<int, QVector<Box> >::const_iterator it = overflow.constBegin(); it != overflow.constEnd(); ++it)
+    {
+        if (!document->chunkBounds(it.key()).intersects(rect)) continue;
+        foreach (Box const& box, it.value())
+        {
+            if (box.rect.intersects(rect))
+                painter->fillRect(box.rect, box.color);
+        }
+    }
+    foreach (QRectF const& bounds, overflowBounds)
+    {
+        if (bounds.intersects(rect))
+            painter->fillRect(bounds, QColor(128, 128, 128, 64));
+    }
+}
+
+QGraphicsItem *ScenePager::create(const ItemState &state, int chunk)
+{
+    QGraphicsItem *item = myScene->itemById(state.id);
+    if (item == nullptr)
+    {
+        if (removedIds.contains(state.id))
+            return nullptr;
+        item = myScene->createItem(overrides.value(state.id, state));
+        if (item == nullptr)
+            return nullptr;
+    }
+    resident.insert(state.id, chunk);
+    return item;
+}
+
+void ScenePager::pageIn(int chunk)
+{
+    QVector<ItemState> arrows;
+    foreach (ItemState const& state, document->readChunk(chunk))
+    {
+        if (state.kind == ItemState::Connector)
+            arrows.append(state);
+        else
+            create(state, chunk);
+    }
+    fetchEndpoints(arrows);
+    foreach (ItemState const& arrow, arrows)
+        create(arrow, chunk);
+    loadedChunks.insert(chunk);
+}
+
+void ScenePager::fetchEndpoints(const QVector<ItemState> &arrows)
+{
+    // endpoints in other chunks are paged in on their own
+    QSet<int> missing;
+    foreach (ItemState const& arrow, arrows)
+    {
+        if (!myScene->itemById(arrow.startId) && !removedIds.contains(arrow.startId))
+            missing.insert(arrow.startId);
+        if (!myScene->itemById(arrow.endId) && !removedIds.contains(arrow.endId))
+            missing.insert(arrow.endId);
+    }
+    if (missing.isEmpty())
+        return;
+
+    foreach (int chunk, document->chunksFor(missing.toList().toVector()))
+    {
+        foreach (ItemState const& state, document->readChunk(chunk))
+        {
+            if (missing.contains(state.id))
+                create(state, chunk);
+        }
+    }
+}
+
+QGraphicsItem *ScenePager::fetch(int id)
+{
+    if (!document || removedIds.contains(id))
+        return nullptr;
+    QVector<int> chunks = document->chunksFor(QVector<int>() << id);
+    if (chunks.isEmpty())
+        return nullptr;
+    foreach (ItemState const& state, document->readChunk(chunks.first()))
+    {
+        if (state.id != id) continue;
+        if (state.kind == ItemState::Connector)
+            fetchEndpoints(QVector<ItemState>() << state);
+        return create(state, chunks.first());
+    }
+    return nullptr;
+}
+
+void ScenePager::forget(int id)
+{
+    if (!document)
+        return;
+    overrides.remove(id);
+    resident.remove(id);
+    removedIds.insert(id);
+}
+
+void ScenePager::restore(int id)
+{
+    if (!document || !removedIds.remove(id))
+        return;
+    // resident again, so it is released with its chunk and paged back in
+    // from its override
+    QVector<int> chunks = document->chunksFor(QVector<int>() << id);
+    if (!chunks.isEmpty())
+        resident.insert(id, chunks.first());
+}
+
+void ScenePager::pinImage(const QByteArray &key)
+{
+    // the items that show it may all be released
+    if (!pinnedImages.contains(key))
+    {
+        pinnedImages.insert(key);
+        ImageStore::retain(key);
+    }
+}
+
+void ScenePager::collectRemoved()
+{
+    // a resident item that is gone was deleted in the editor
+    QMutableHashIterator<int, int> it(resident);
+    while (it.hasNext())
+    {
+        it.next();
+        if (myScene->itemById(it.key()) == nullptr)
+        {
+            overrides.remove(it.key());
+            removedIds.insert(it.key());
+            it.remove();
+        }
+    }
+}
+
+void ScenePager::release(const QRectF &keep)
+{
+    QSet<int> candidates;
+    for (QHash<int, int>::const_iterator it = resident.constBegin(); it != resident.constEnd(); ++it)
+    {
+        if (loadedChunks.contains(it.value())) continue;
+        QGraphicsItem *item = myScene->itemById(it.key());
+        if (item->isSelected() || item->hasFocus() || item->sceneBoundingRect().intersects(keep)) continue;
+        candidates.insert(it.key());
+    }
+
+    QList<Arrow*> arrows;
+    QList<QGraphicsItem*> others;
+    foreach (int id, candidates)
+    {
+        QGraphicsItem *item = myScene->itemById(id);
+        if (item->type() == Arrow::Type)
+        {
+            arrows.append(qgraphicsitem_cast<Arrow*>(item));
+            continue;
+        }
+        if (item->type() == CustomItem::Type)
+        {
+            // an arrow that stays pins its endpoints
+            bool pinned = false;
+            foreach (Arrow *arrow, qgraphicsitem_cast<CustomItem*>(item)->getArrows())
+                pinned = pinned || !candidates.contains(arrow->id());
+            if (pinned) continue;
+        }
+        others.append(item);
+    }
+
+    foreach (Arrow *arrow, arrows)
+    {
+        // an arrow follows its endpoints, so it is edited when they are
+        if (myScene->wasEdited(arrow->id()) || myScene->wasEdited(arrow->startItem()->id())
+                || myScene->wasEdited(arrow->endItem()->id()))
+            overrides.insert(arrow->id(), ItemState::capture(arrow));
+        resident.remove(arrow->id());
+        myScene->removeItem(arrow);
+        arrow->startItem()->removeArrow(arrow);
+        arrow->endItem()->removeArrow(arrow);
+        delete arrow;
+    }
+    foreach (QGraphicsItem *item, others)
+    {
+        int id = ItemState::itemId(item);
+        if (myScene->wasEdited(id))
+        {
+            ItemState state = ItemState::capture(item);
+            if (state.kind == ItemState::Pixmap)
+                pinImage(state.image);
+            overrides.insert(id, state);
+        }
+        resident.remove(id);
+        myScene->removeItem(item);
+        delete item;
+    }
+    if (!arrows.isEmpty() || !others.isEmpty())
+        qDebug() << "released" << arrows.size() + others.size() << "items," << resident.size() << "resident";
+}
+
+QVector<ItemState> ScenePager::snapshot()
+{
+    collectRemoved();
+    QVector<ItemState> states;
+    QVector<ItemState> arrows;
+    QSet<int> seen;
+    for (int chunk = 0; chunk < document->chunkCount(); ++chunk)
+    {
+        foreach (ItemState state, document->readChunk(chunk))
+        {
+            seen.insert(state.id);
+            if (QGraphicsItem *item = myScene->itemById(state.id))
+                state = ItemState::capture(item);
+            else if (overrides.contains(state.id))
+                state = overrides.value(state.id);
+            else if (removedIds.contains(state.id))
+                continue;
+            if (state.kind == ItemState::Connector)
+                arrows.append(state);
+            else
+                states.append(state);
+        }
+    }
+
+    // items created since the document was opened
+    foreach (QGraphicsItem *item, myScene->items())
+    {
+        ItemState state = ItemState::capture(item);
+        if (!state.isValid() || seen.contains(state.id)) continue;
+        if (state.kind == ItemState::Connector)
+            arrows.append(state);
+        else
+            states.append(state);
+    }
+
+    // an arrow goes with a shape that was deleted while it was released
+    QSet<int> present;
+    foreach (ItemState const& state, states)
+        present.insert(state.id);
+    foreach (ItemState const& arrow, arrows)
+    {
+        if (present.contains(arrow.startId) && present.contains(arrow.endId))
+            states.append(arrow);
+    }
+    return states;
+}
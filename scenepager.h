@@ -0,0 +1,106 @@
+#ifndef SCENEPAGER_H
+#define SCENEPAGER_H
+
+#include "compresseddocument.h"
+#include "itemstate.h"
+
+#include <QColor>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QRectF>
+#include <QSet>
+#include <QTimer>
+#include <QVector>
+
+class CustomScene;
+class CustomView;
+class QGraphicsItem;
+class QPainter;
+
+// Keeps only the part of a large compressed document (".dpz") around the
+// view in the scene. Chunks whose bounds meet the viewport plus a margin
+// are paged in, chunks that drift out of a wider margin are released.
+// Zoomed out past MaxChunks, the chunks further out are not paged in but
+// drawn under the scene as the boxes their shapes would be at that zoom.
+// Arrows pin their endpoints, so an arrow into a released chunk keeps that
+// one shape. Edited items keep their state here when they are released,
+// and removed ones are remembered, so the document as a whole is always
+// what snapshot() returns.
+class ScenePager : public QObject
+{
+    Q_OBJECT
+
+public:
+    // documents smaller than this are simply loaded
+    static const int Threshold = 50000;
+    static const int Margin = 1000;
+    static const int MaxChunks = 64;
+    // beyond these, only the chunk's bounds are shaded
+    static const int MaxBoxedChunks = 256;
+    static const int UpdateDelay = 50;
+
+    ScenePager(CustomScene *scene, CustomView *view, QObject *parent = nullptr);
+    ~ScenePager();
+
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const { return document != nullptr; }
+    QString fileName() const { return document ? document->fileName() : QString(); }
+    QString errorString() const { return myErrorString; }
+    int itemCount() const { return document ? document->itemCount() : 0; }
+    QRectF bounds() const;
+
+    // pages in a single released item, nullptr if there is none
+    QGraphicsItem *fetch(int id);
+    // an item removed while it was released
+    void forget(int id);
+    // an item the scene created again after it was removed
+    void restore(int id);
+
+    // the whole document with the edits, for saving
+    QVector<ItemState> snapshot();
+    // Moves a saved snapshot over the paged file and pages from it. The
+    // open file is mapped, which Windows does not let anything replace,
+    // so snapshots of it are written elsewhere and swapped in here.
+    bool replaceFile(const QString &savedFile, QString *errorString);
+
+    // the chunks in view that are not paged in
+    void drawOverflow(QPainter *painter, QRectF const& rect) const;
+
+public slots:
+    void update();
+
+private slots:
+    void pageViewport();
+
+private:
+    QGraphicsItem *create(ItemState const& state, int chunk);
+    void pageIn(int chunk);
+    void release(QRectF const& keep);
+    void collectRemoved();
+    void fetchEndpoints(QVector<ItemState> const& arrows);
+    void updateOverflow(QList<int> const& chunks);
+    void pinImage(QByteArray const& key);
+
+    struct Box
+    {
+        QRectF rect;
+        QColor color;
+    };
+
+    CustomScene *myScene;
+    CustomView *myView;
+    CompressedDocument *document = nullptr;
+    QTimer updateTimer;
+    QSet<int> loadedChunks;
+    QHash<int, int> resident;              // id -> chunk it was read from
+    QHash<int, ItemState> overrides;       // edited items that were released
+    QSet<int> removedIds;
+    QSet<QByteArray> pinnedImages;         // of the file and the overrides
+    QHash<int, QVector<Box> > overflow;    // chunk -> its shapes as boxes
+    QVector<QRectF> overflowBounds;
+    QString myErrorString;
+};
+
+#endif // SCENEPAGER_H
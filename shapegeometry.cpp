@@ -0,0 +1,212 @@
+#include "shapegeometry.h"
+
+#include <QPainter>
+#include <QtMath>
+
+namespace {
+
+qreal cross(QPointF const& a, QPointF const& b)
+{
+    return a.x() * b.y() - a.y() * b.x();
+}
+
+// Lowers *best to the parameter along line where it crosses segment ab.
+void crossSegment(QLineF const& line, QPointF const& a, QPointF const& b, qreal *best)
+{
+    QPointF d = line.p2() - line.p1();
+    QPointF e = b - a;
+    qreal denominator = cross(d, e);
+    if (qFuzzyIsNull(denominator))
+        return;
+    QPointF offset = a - line.p1();
+    qreal t = cross(offset, e) / denominator;
+    qreal u = cross(offset, d) / denominator;
+    if (t >= 0 && t <= 1 && u >= 0 && u <= 1 && t < *best)
+        *best = t;
+}
+
+// Lowers *best to the parameter along line where it crosses the ellipse
+// around center. A non-zero sign keeps only the crossings on that side of
+// the center, which makes the ellipse a corner arc.
+void crossEllipse(QLineF const& line, QPointF const& center, qreal rx, qreal ry,
+                  qreal *best, qreal xSign = 0, qreal ySign = 0)
+{
+    if (rx <= 0 || ry <= 0)
+        return;
+    QPointF p((line.x1() - center.x()) / rx, (line.y1() - center.y()) / ry);
+    QPointF q(line.dx() / rx, line.dy() / ry);
+    qreal a = QPointF::dotProduct(q, q);
+    qreal b = 2 * QPointF::dotProduct(p, q);
+    qreal c = QPointF::dotProduct(p, p) - 1;
+    qreal discriminant = b * b - 4 * a * c;
+    if (qFuzzyIsNull(a) || discriminant < 0)
+        return;
+    qreal root = qSqrt(discriminant);
+    qreal roots[2] = { (-b - root) / (2 * a), (-b + root) / (2 * a) };
+    for (qreal t : roots)
+    {
+        if (t < 0 || t > 1 || t >= *best) continue;
+        QPointF at = line.pointAt(t) - center;
+        if (at.x() * xSign < 0 || at.y() * ySign < 0) continue;
+        *best = t;
+    }
+}
+
+}
+
+ShapeGeometry ShapeGeometry::outline(const QPolygonF &polygon)
+{
+    ShapeGeometry geometry;
+    geometry.myKind = Outline;
+    geometry.myPolygon = polygon;
+    geometry.myRect = polygon.boundingRect();
+    return geometry;
+}
+
+ShapeGeometry ShapeGeometry::ellipse(const QRectF &rect)
+{
+    ShapeGeometry geometry;
+    geometry.myKind = Ellipse;
+    geometry.myRect = rect.normalized();
+    return geometry;
+}
+
+ShapeGeometry ShapeGeometry::roundedRect(const QRectF &rect, qreal xRadius, qreal yRadius)
+{
+    ShapeGeometry geometry;
+    geometry.myKind = RoundedRect;
+    geometry.myRect = rect.normalized();
+    geometry.myXRadius = qBound(qreal(0), xRadius, geometry.myRect.width() / 2);
+    geometry.myYRadius = qBound(qreal(0), yRadius, geometry.myRect.height() / 2);
+    return geometry;
+}
+
+ShapeGeometry ShapeGeometry::regularPolygon(const QRectF &rect, int sides)
+{
+    ShapeGeometry geometry;
+    geometry.myKind = RegularPolygon;
+    geometry.myRect = rect.normalized();
+    geometry.mySides = qMax(3, sides);
+    return geometry;
+}
+
+QRectF ShapeGeometry::boundingRect() const
+{
+    return myRect;
+}
+
+QPolygonF ShapeGeometry::vertices() const
+{
+    if (myKind == Outline)
+        return myPolygon;
+
+    // the first corner at the top, the polygon inscribed in the ellipse of
+    // the box so that it scales with it
+    QPolygonF polygon;
+    polygon.reserve(mySides + 1);
+    for (int i = 0; i < mySides; ++i)
+    {
+        qreal angle = -M_PI / 2 + 2 * M_PI * i / mySides;
+        polygon << myRect.center() + QPointF(qCos(angle) * myRect.width() / 2,
+                                             qSin(angle) * myRect.height() / 2);
+    }
+    polygon << polygon.first();
+    return polygon;
+}
+
+bool ShapeGeometry::contains(const QPointF &point) const
+{
+    switch (myKind) {
+    case Ellipse:
+    {
+        if (myRect.isEmpty())
+            return false;
+        qreal dx = (point.x() - myRect.center().x()) / (myRect.width() / 2);
+        qreal dy = (point.y() - myRect.center().y()) / (myRect.height() / 2);
+        return dx * dx + dy * dy <= 1;
+    }
+    case RoundedRect:
+    {
+        if (!myRect.contains(point))
+            return false;
+        // outside the corners the nearest point of the inner rect is the
+        // point itself
+        qreal cx = qBound(myRect.left() + myXRadius, point.x(), myRect.right() - myXRadius);
+        qreal cy = qBound(myRect.top() + myYRadius, point.y(), myRect.bottom() - myYRadius);
+        qreal dx = myXRadius > 0 ? (point.x() - cx) / myXRadius : 0;
+        qreal dy = myYRadius > 0 ? (point.y() - cy) / myYRadius : 0;
+        return dx * dx + dy * dy <= 1;
+    }
+    case RegularPolygon:
+        return myRect.contains(point) && vertices().containsPoint(point, Qt::OddEvenFill);
+    default:
+        return myPolygon.containsPoint(point, Qt::OddEvenFill);
+    }
+}
+
+bool ShapeGeometry::intersect(const QLineF &line, QPointF *point) const
+{
+    qreal best = 2;
+    switch (myKind) {
+    case Ellipse:
+        crossEllipse(line, myRect.center(), myRect.width() / 2, myRect.height() / 2, &best);
+        break;
+    case RoundedRect:
+    {
+        qreal l = myRect.left(), t = myRect.top(), r = myRect.right(), b = myRect.bottom();
+        qreal rx = myXRadius, ry = myYRadius;
+        crossSegment(line, QPointF(l + rx, t), QPointF(r - rx, t), &best);
+        crossSegment(line, QPointF(r, t + ry), QPointF(r, b - ry), &best);
+        crossSegment(line, QPointF(r - rx, b), QPointF(l + rx, b), &best);
+        crossSegment(line, QPointF(l, b - ry), QPointF(l, t + ry), &best);
+        crossEllipse(line, QPointF(l + rx, t + ry), rx, ry, &best, -1, -1);
+        crossEllipse(line, QPointF(r - rx, t + ry), rx, ry, &best, 1, -1);
+        crossEllipse(line, QPointF(r - rx, b - ry), rx, ry, &best, 1, 1);
+        crossEllipse(line, QPointF(l + rx, b - ry), rx, ry, &best, -1, 1);
+        break;
+    }
+    default:
+    {
+        QPolygonF polygon = vertices();
+        for (int i = 1; i < polygon.size(); ++i)
+            crossSegment(line, polygon.at(i - 1), polygon.at(i), &best);
+        break;
+    }
+    }
+    if (best > 1)
+        return false;
+    *point = line.pointAt(best);
+    return true;
+}
+
+QPainterPath ShapeGeometry::path() const
+{
+    QPainterPath path;
+    switch (myKind) {
+    case Ellipse:
+        path.addEllipse(myRect);
+        break;
+    case RoundedRect:
+        path.addRoundedRect(myRect, myXRadius, myYRadius);
+        break;
+    default:
+        path.addPolygon(vertices());
+        break;
+    }
+    return path;
+}
+
+void ShapeGeometry::draw(QPainter *painter) const
+{
+    switch (myKind) {
+    case Ellipse:
+        painter->drawEllipse(myRect);
+        break;
+    case RoundedRect:
+        painter->drawRoundedRect(myRect, myXRadius, myYRadius);
+        break;
+    default:
+        painter->drawPolygon(vertices());
+        break;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef SHAPEGEOMETRY_H
+#define SHAPEGEOMETRY_H
+
+#include <QLineF>
+#include <QPainterPath>
+#include <QPolygonF>
+#include <QRectF>
+
+class QPainter;
+
+// The outline of a shape in item coordinates. Round shapes are described
+// analytically, as an ellipse, a rounded rect or a regular polygon inscribed
+// in their box, so containment and line intersection are worked out in
+// closed form and nothing is flattened until the paint engine draws them at
+// the resolution of the device. Any other shape is a plain polygon outline.
+class ShapeGeometry
+{
+public:
+    enum Kind { Outline, Ellipse, RoundedRect, RegularPolygon };
+
+    static ShapeGeometry outline(QPolygonF const& polygon);
+    static ShapeGeometry ellipse(QRectF const& rect);
+    static ShapeGeometry roundedRect(QRectF const& rect, qreal xRadius, qreal yRadius);
+    static ShapeGeometry regularPolygon(QRectF const& rect, int sides);
+
+    Kind kind() const { return myKind; }
+    bool isAnalytic() const { return myKind != Outline; }
+    QRectF boundingRect() const;
+    bool contains(QPointF const& point) const;
+
+    // The first point where line, followed from p1 to p2, crosses the
+    // outline. Returns false if it does not.
+    bool intersect(QLineF const& line, QPointF *point) const;
+
+    QPainterPath path() const;
+    void draw(QPainter *painter) const;
+
+private:
+    QPolygonF vertices() const;
+
+    Kind myKind = Outline;
+    QRectF myRect;
+    qreal myXRadius = 0;
+    qreal myYRadius = 0;
+    int mySides = 0;
+    QPolygonF myPolygon;                   // Outline only
+};
+
+#endif // SHAPEGEOMETRY_H
@@ -0,0 +1,273 @@
+#include "undojournal.h"
+#include "customscene.h"
+#include "imagestore.h"
+#include "undosystem.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFileInfo>
+
+#if defined(Q_OS_WIN)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+UndoJournal::UndoJournal(QObject *parent)
+    : QObject(parent)
+{
+    syncTimer.setSingleShot(true);
+    syncTimer.setInterval(SyncInterval);
+    connect(&syncTimer, SIGNAL(timeout()), this, SLOT(sync()));
+}
+
+UndoJournal::~UndoJournal()
+{
+    close();
+}
+
+QString UndoJournal::journalPath(const QString &documentPath)
+{
+    return documentPath + ".journal";
+}
+
+bool UndoJournal::hasEntries(const QString &documentPath)
+{
+    QFileInfo info(journalPath(documentPath));
+    if (!info.exists() || info.size() <= qint64(sizeof(Magic) + sizeof(Version)))
+        return false;
+
+    QFile journal(info.filePath());
+    if (!journal.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&journal);
+    in.setVersion(QDataStream::Qt_5_6);
+    quint32 magic;
+    quint16 version;
+    in >> magic >> version;
+    if (in.status() != QDataStream::Ok || magic != Magic || version < 1 || version > Version)
+        return true;            // let replay report it
+
+    // anything after the last Saved mark
+    bool unsaved = false;
+    while (!in.atEnd())
+    {
+        quint8 op;
+        quint32 size;
+        in >> op >> size;
+        if (in.status() != QDataStream::Ok || size > quint32(journal.size() - journal.pos()))
+            break;
+        unsaved = op != Saved;
+        in.skipRawData(int(size));
+    }
+    return unsaved;
+}
+
+int UndoJournal::replay(const QString &documentPath, CustomScene *scene, UndoSystem *undoSystem)
+{
+    QFile journal(journalPath(documentPath));
+    if (!journal.open(QIODevice::ReadOnly))
+        return -1;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // one read, then decode from memory
+    QByteArray data = journal.readAll();
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_6);
+
+    quint32 magic;
+    quint16 version;
+    in >> magic >> version;
+    if (in.status() != QDataStream::Ok || magic != Magic || version < 1 || version > Version)
+    {
+        qDebug() << "journal" << journal.fileName() << "has an unknown format";
+        return -1;
+    }
+
+    int replayed = 0;
+    scene->beginTransaction(UndoCommand::Insert);
+    while (!in.atEnd())
+    {
+        quint8 op;
+        quint32 size;
+        in >> op >> size;
+        // a torn record at the end is what a crash in mid-write leaves
+        if (in.status() != QDataStream::Ok || size > quint32(data.size() - in.device()->pos()))
+            break;
+
+        if (op == Push)
+        {
+            QByteArray payload(int(size), Qt::Uninitialized);
+            in.readRawData(payload.data(), int(size));
+            QDataStream commandStream(payload);
+            commandStream.setVersion(QDataStream::Qt_5_6);
+            UndoCommand *command = new UndoCommand(UndoCommand::Insert);
+            commandStream >> *command;
+            if (commandStream.status() != QDataStream::Ok)
+            {
+                delete command;
+                break;
+            }
+            command->redo(scene);
+            undoSystem->push(command);
+        }
+        else if (op == Undo)
+        {
+            undoSystem->undo(scene);
+        }
+        else if (op == Redo)
+        {
+            undoSystem->redo(scene);
+        }
+        else if (op == Saved)
+        {
+            continue;
+        }
+        else if (op == Image)
+        {
+            QByteArray payload(int(size), Qt::Uninitialized);
+            in.readRawData(payload.data(), int(size));
+            QDataStream imageStream(payload);
+            imageStream.setVersion(QDataStream::Qt_5_6);
+            QByteArray key, image;
+            imageStream >> key >> image;
+            if (imageStream.status() != QDataStream::Ok)
+                break;
+            ImageStore::insertEncoded(key, image);
+            continue;
+        }
+        else
+        {
+            break;
+        }
+        replayed++;
+    }
+    scene->commitTransaction();
+
+    qDebug() << "replayed" << replayed << "journal records in" << timer.elapsed() << "ms";
+    return replayed;
+}
+
+bool UndoJournal::open(const QString &documentPath, bool append)
+{
+    close();
+    writtenImages.clear();
+    file.setFileName(journalPath(documentPath));
+    if (!file.open(append ? QIODevice::ReadWrite | QIODevice::Append
+                          : QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qDebug() << "cannot open journal" << file.fileName() << file.errorString();
+        return false;
+    }
+    if (file.size() == 0)
+        writeHeader();
+    return true;
+}
+
+bool UndoJournal::rename(const QString &documentPath)
+{
+    QString path = journalPath(documentPath);
+    if (file.isOpen() && file.fileName() == path)
+        return true;
+    if (!file.isOpen())
+        return open(documentPath, false);
+
+    QSet<QByteArray> images = writtenImages;
+    close();
+    QFile::remove(path);
+    if (!file.rename(path))
+    {
+        qDebug() << "cannot move journal" << file.fileName() << "to" << path << file.errorString();
+        return open(documentPath, false);
+    }
+    bool opened = open(documentPath, true);
+    writtenImages = images;
+    return opened;
+}
+
+void UndoJournal::reset()
+{
+    if (!file.isOpen()) return;
+    syncTimer.stop();
+    file.resize(0);
+    file.seek(0);
+    writtenImages.clear();
+    writeHeader();
+    sync();
+}
+
+void UndoJournal::close()
+{
+    if (!file.isOpen()) return;
+    sync();
+    file.close();
+}
+
+void UndoJournal::recordPush(const UndoCommand &command)
+{
+    if (!file.isOpen()) return;
+    foreach (QByteArray const& key, command.imageKeys())
+    {
+        if (writtenImages.contains(key)) continue;
+        writtenImages.insert(key);
+        QByteArray image;
+        QDataStream imageOut(&image, QIODevice::WriteOnly);
+        imageOut.setVersion(QDataStream::Qt_5_6);
+        imageOut << key << ImageStore::encoded(key);
+        append(Image, image);
+    }
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << command;
+    append(Push, payload);
+}
+
+void UndoJournal::recordUndo()
+{
+    append(Undo);
+}
+
+void UndoJournal::recordRedo()
+{
+    append(Redo);
+}
+
+void UndoJournal::recordSaved()
+{
+    append(Saved);
+}
+
+void UndoJournal::sync()
+{
+    syncTimer.stop();
+    if (!file.isOpen()) return;
+    file.flush();
+#if defined(Q_OS_WIN)
+    _commit(file.handle());
+#else
+    ::fsync(file.handle());
+#endif
+}
+
+void UndoJournal::writeHeader()
+{
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << Magic << Version;
+}
+
+void UndoJournal::append(Operation op, const QByteArray &payload)
+{
+    if (!file.isOpen()) return;
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << quint8(op) << quint32(payload.size());
+    out.writeRawData(payload.constData(), payload.size());
+    if (!syncTimer.isActive())
+        syncTimer.start();
+}
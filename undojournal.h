@@ -0,0 +1,66 @@
+#ifndef UNDOJOURNAL_H
+#define UNDOJOURNAL_H
+
+#include <QFile>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+
+class CustomScene;
+class UndoCommand;
+class UndoSystem;
+
+// Append-only binary log of the undo history, kept next to the document
+// as "<document>.journal". Every pushed command and every undo/redo is
+// appended; the data is flushed and fsync'ed in batches by a timer. After a
+// crash the journal is replayed on top of the last saved document.
+//
+// Items only refer to their images by ImageStore key, so each image goes
+// into the journal once, encoded, before the first record that uses it.
+//
+// A save appends a Saved mark; only records after the last mark are unsaved
+// changes. Replaying the steps before it on top of the saved document
+// changes nothing, and brings the history back for undo and redo.
+class UndoJournal : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit UndoJournal(QObject *parent = nullptr);
+    ~UndoJournal();
+
+    static QString journalPath(const QString &documentPath);
+    static bool hasEntries(const QString &documentPath);
+    static int replay(const QString &documentPath, CustomScene *scene, UndoSystem *undoSystem);
+
+    bool open(const QString &documentPath, bool append);
+    // moves the journal along with a document saved under a new name
+    bool rename(const QString &documentPath);
+    void reset();
+    void close();
+    bool isOpen() const { return file.isOpen(); }
+
+    void recordPush(UndoCommand const& command);
+    void recordUndo();
+    void recordRedo();
+    void recordSaved();
+
+public slots:
+    void sync();
+
+private:
+    enum Operation { Push = 1, Undo, Redo, Saved, Image };
+
+    void writeHeader();
+    void append(Operation op, QByteArray const& payload = QByteArray());
+
+    QFile file;
+    QTimer syncTimer;
+    QSet<QByteArray> writtenImages;
+
+    static const quint32 Magic = 0x44504a4c; // "DPJL"
+    static const quint16 Version = 2;       // 1 had no Saved marks
+    static const int SyncInterval = 1000;
+};
+
+#endif // UNDOJOURNAL_H
@@ -1,37 +1,219 @@
 #include "undosystem.h"
+#include "customscene.h"
+#include "imagestore.h"
+#include "undojournal.h"
+#include <QDataStream>
 #include <QDebug>
 
-void UndoSystem::backup(const QList<QGraphicsItem*>&& items)
+void UndoCommand::addChange(const ItemState& before, const ItemState& after)
 {
-    qDebug() << "inside backup." << items.size();
-    int stackSize = itemsStack.length();
-    if (currentIndex < stackSize - 1)
+    QPair<int, int> key = before.isValid() ? qMakePair(before.id, before.fields)
+                                           : qMakePair(after.id, after.fields);
+    QHash<QPair<int, int>, int>::const_iterator it = changeIndex.constFind(key);
+    if (it != changeIndex.constEnd())
     {
-        for (int i = currentIndex + 1; i < stackSize; ++i)
-        {
-            free(itemsStack[i]);
-        }
-        itemsStack.erase(itemsStack.begin() + currentIndex + 1, itemsStack.end());
+        changes[it.value()].after = after;
+        return;
     }
+    changeIndex.insert(key, changes.size());
+    changes.append(Change{before, after});
+}
+
+void UndoCommand::merge(const UndoCommand& other)
+{
+    foreach (Change const& change, other.changes)
+        addChange(change.before, change.after);
+}
+
+qint64 UndoCommand::byteSize() const
+{
+    qint64 size = sizeof(UndoCommand) + changes.capacity() * qint64(sizeof(Change));
+    size += changeIndex.size() * qint64(sizeof(QPair<int, int>) + sizeof(int));
+    foreach (Change const& change, changes)
+    {
+        size += change.before.byteSize() - qint64(sizeof(ItemState));
+        size += change.after.byteSize() - qint64(sizeof(ItemState));
+    }
+    return size;
+}
+
+QVector<int> UndoCommand::itemIds() const
+{
+    QVector<int> ids;
+    ids.reserve(changes.size());
+    foreach (Change const& change, changes)
+        ids.append(change.before.isValid() ? change.before.id : change.after.id);
+    return ids;
+}
+
+QSet<QByteArray> UndoCommand::imageKeys() const
+{
+    QSet<QByteArray> keys;
+    foreach (Change const& change, changes)
+    {
+        if (change.before.kind == ItemState::Pixmap && !change.before.image.isEmpty())
+            keys.insert(change.before.image);
+        if (change.after.kind == ItemState::Pixmap && !change.after.image.isEmpty())
+            keys.insert(change.after.image);
+    }
+    return keys;
+}
+
+void UndoCommand::apply(CustomScene *scene, bool forward)
+{
+    QVector<ItemState> targets;
+    QVector<int> removals;
+    targets.reserve(changes.size());
+    for (int i = 0; i < changes.size(); ++i)
+    {
+        Change const& change = changes.at(forward ? i : changes.size() - 1 - i);
+        ItemState const& target = forward ? change.after : change.before;
+        ItemState const& source = forward ? change.before : change.after;
+        if (target.isValid())
+            targets.append(target);
+        else if (source.isValid())
+            removals.append(source.id);
+    }
+    scene->reconcile(targets, removals);
+}
 
-    itemsStack.push_back(items);
+UndoSystem::~UndoSystem()
+{
+    free(0, commands.length());
+}
+
+void UndoSystem::push(UndoCommand *command)
+{
+    if (command->isEmpty())
+    {
+        delete command;
+        return;
+    }
+    qDebug() << "push undo command" << command->kind();
+    if (myJournal)
+        myJournal->recordPush(*command);
+
+    int stackSize = commands.length();
+    if (currentIndex < stackSize)
+    {
+        free(currentIndex, stackSize);
+        commands.erase(commands.begin() + currentIndex, commands.end());
+        commandSizes.erase(commandSizes.begin() + currentIndex, commandSizes.end());
+    }
+
+    myRevision++;
+    foreach (QByteArray const& key, command->imageKeys())
+        ImageStore::retain(key);
+    commands.push_back(command);
+    commandSizes.push_back(command->byteSize());
+    totalBytes += commandSizes.last();
     currentIndex++;
+    enforceBudget();
+}
+
+void UndoSystem::undo(CustomScene *scene)
+{
+    if (isEmpty()) return;
+    UndoCommand *command = commands[--currentIndex];
+    myRevision++;
+    if (myJournal)
+        myJournal->recordUndo();
+    scene->beginTransaction(command->kind());
+    command->undo(scene);
+    scene->commitTransaction();
+}
+
+void UndoSystem::redo(CustomScene *scene)
+{
+    if (isFull()) return;
+    UndoCommand *command = commands[currentIndex++];
+    myRevision++;
+    if (myJournal)
+        myJournal->recordRedo();
+    scene->beginTransaction(command->kind());
+    command->redo(scene);
+    scene->commitTransaction();
 }
 
-QList<QGraphicsItem*> UndoSystem::undo()
+void UndoSystem::clear()
 {
-    return itemsStack[--currentIndex];
+    free(0, commands.length());
+    commands.clear();
+    commandSizes.clear();
+    currentIndex = 0;
+}
+
+void UndoSystem::setMemoryBudget(qint64 maxBytes, int maxSteps)
+{
+    myMaxBytes = maxBytes;
+    myMaxSteps = maxSteps;
+    enforceBudget();
+}
+
+void UndoSystem::free(int from, int to)
+{
+    for (int i = from; i < to; ++i)
+    {
+        totalBytes -= commandSizes[i];
+        drop(commands[i]);
+    }
+}
+
+void UndoSystem::drop(UndoCommand *command)
+{
+    foreach (QByteArray const& key, command->imageKeys())
+        ImageStore::release(key);
+    delete command;
+}
+
+bool UndoSystem::overBudget() const
+{
+    return (myMaxBytes > 0 && totalBytes > myMaxBytes)
+            || (myMaxSteps > 0 && commands.length() > myMaxSteps);
+}
+
+void UndoSystem::enforceBudget()
+{
+    // drop the redo steps, furthest first, then the oldest undo steps, but
+    // never the step that was just made
+    int evicted = 0;
+    while (overBudget() && currentIndex < commands.length())
+    {
+        totalBytes -= commandSizes.takeLast();
+        drop(commands.takeLast());
+        evicted++;
+    }
+    while (overBudget() && currentIndex > 1)
+    {
+        totalBytes -= commandSizes.takeFirst();
+        drop(commands.takeFirst());
+        currentIndex--;
+        evicted++;
+    }
+    if (evicted > 0)
+        qDebug() << "undo history evicted" << evicted << "steps," << totalBytes << "bytes left";
 }
 
-QList<QGraphicsItem*> UndoSystem::redo()
+QDataStream &operator<<(QDataStream &out, const UndoCommand &command)
 {
-    return itemsStack[++currentIndex];
+    out << qint8(command.myKind) << qint32(command.changes.size());
+    foreach (UndoCommand::Change const& change, command.changes)
+        out << change.before << change.after;
+    return out;
 }
 
-void UndoSystem::free(QList<QGraphicsItem*> const& items)
+QDataStream &operator>>(QDataStream &in, UndoCommand &command)
 {
-    foreach(QGraphicsItem* p, items)
+    qint8 kind;
+    qint32 count;
+    in >> kind >> count;
+    command.myKind = UndoCommand::Kind(kind);
+    command.changes.reserve(qBound(0, int(count), 4096));
+    for (int i = 0; i < count && in.status() == QDataStream::Ok; ++i)
     {
-        delete p;
+        ItemState before, after;
+        in >> before >> after;
+        command.addChange(before, after);
     }
+    return in;
 }
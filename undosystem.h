@@ -1,20 +1,101 @@
 #ifndef UNDOSYSTEM_H
 #define UNDOSYSTEM_H
-#include "customitem.h"
-#include "customscene.h"
 
+#include "itemstate.h"
+
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QSet>
+#include <QVector>
+
+class CustomScene;
+class QDataStream;
+class UndoJournal;
+
+// One reversible edit. It only stores the states of the items it touched,
+// keyed by item id, so undo/redo cost follows the size of the edit.
+// An invalid `before` state means the item was created by the edit, an
+// invalid `after` state means it was removed. Repeated changes of the same
+// item and fields collapse into one, keeping the first `before`.
+class UndoCommand
+{
+public:
+    enum Kind { Move, Resize, Insert, Delete, Restyle, Connect, TextEdit };
+
+    explicit UndoCommand(Kind kind) : myKind(kind) {}
+
+    Kind kind() const { return myKind; }
+    bool isEmpty() const { return changes.isEmpty(); }
+    qint64 byteSize() const;
+    QVector<int> itemIds() const;
+    QSet<QByteArray> imageKeys() const;
+
+    void addChange(ItemState const& before, ItemState const& after);
+    void merge(UndoCommand const& other);
+
+    void undo(CustomScene *scene) { apply(scene, false); }
+    void redo(CustomScene *scene) { apply(scene, true); }
+
+    friend QDataStream &operator<<(QDataStream &out, UndoCommand const& command);
+    friend QDataStream &operator>>(QDataStream &in, UndoCommand &command);
+
+private:
+    struct Change
+    {
+        ItemState before;
+        ItemState after;
+    };
+
+    void apply(CustomScene *scene, bool forward);
+
+    Kind myKind;
+    QVector<Change> changes;
+    QHash<QPair<int, int>, int> changeIndex;
+};
+
+// History of applied commands. The history is kept under a memory budget
+// (bytes and/or number of steps, 0 meaning unlimited); once it is exceeded
+// the redo steps are dropped, then the oldest undo steps. Since commands are deltas against the
+// live scene, nothing has to be folded into a checkpoint when they go.
 class UndoSystem {
 public:
-    void backup(QList<QGraphicsItem*> const&& items);
-    QList<QGraphicsItem*> undo();
-    QList<QGraphicsItem*> redo();
-    bool isEmpty() {return currentIndex < 1;}
-    bool isFull() {return currentIndex + 1 == itemsStack.length();}
+    ~UndoSystem();
+
+    void push(UndoCommand *command);
+    void undo(CustomScene *scene);
+    void redo(CustomScene *scene);
+    void clear();
+    bool isEmpty() const {return currentIndex < 1;}
+    bool isFull() const {return currentIndex == commands.length();}
+
+    void setJournal(UndoJournal *journal) { myJournal = journal; }
+
+    void setMemoryBudget(qint64 maxBytes, int maxSteps);
+    qint64 maxBytes() const { return myMaxBytes; }
+    int maxSteps() const { return myMaxSteps; }
+    qint64 byteSize() const { return totalBytes; }
+    int count() const { return commands.length(); }
+
+    // bumped by every push, undo and redo
+    int revision() const { return myRevision; }
 
 private:
-    void free(QList<QGraphicsItem*> const& items);
-    QList<QList<QGraphicsItem*>> itemsStack;
-    int currentIndex = -1;
+    void free(int from, int to);
+    void drop(UndoCommand *command);
+    void enforceBudget();
+    bool overBudget() const;
+    QList<UndoCommand*> commands;
+    QList<qint64> commandSizes;
+    int currentIndex = 0;
+    qint64 totalBytes = 0;
+    qint64 myMaxBytes = 0;
+    int myMaxSteps = 0;
+    int myRevision = 0;
+    UndoJournal *myJournal = nullptr;
 };
 
+QDataStream &operator<<(QDataStream &out, UndoCommand const& command);
+QDataStream &operator>>(QDataStream &in, UndoCommand &command);
+
 #endif // UNDOSYSTEM_H
@@ -0,0 +1,208 @@
+#include "xmldocument.h"
+#include "imagestore.h"
+
+#include <QIODevice>
+#include <QStringList>
+#include <algorithm>
+#include <climits>
+
+namespace {
+
+// as many digits as it takes to read back the same double
+QString number(qreal value)
+{
+    return QString::number(value, 'g', 17);
+}
+
+}
+
+XmlDocumentWriter::XmlDocumentWriter(QIODevice *device)
+    : xml(device)
+{
+    xml.setAutoFormatting(true);
+    xml.writeStartDocument();
+    xml.writeStartElement("scene");
+    xml.writeStartElement("Scene");
+}
+
+void XmlDocumentWriter::writeItem(const ItemState &state)
+{
+    switch (state.kind) {
+    case ItemState::Shape:
+    {
+        QPointF center = state.polygon.boundingRect().center();
+        xml.writeEmptyElement("CustomItem");
+        xml.writeAttribute("id", QString::number(state.id));
+        xml.writeAttribute("type", QString::number(state.customType));
+        xml.writeAttribute("x", number(state.pos.x()));
+        xml.writeAttribute("y", number(state.pos.y()));
+        xml.writeAttribute("centerX", number(center.x()));
+        xml.writeAttribute("centerY", number(center.y()));
+        break;
+    }
+    case ItemState::Connector:
+        xml.writeEmptyElement("Arrow");
+        xml.writeAttribute("id", QString::number(state.id));
+        xml.writeAttribute("startItemId", QString::number(state.startId));
+        xml.writeAttribute("endItemId", QString::number(state.endId));
+        xml.writeAttribute("lineColor", state.color.name());
+        xml.writeAttribute("intersectX", number(state.pos.x()));
+        xml.writeAttribute("intersectY", number(state.pos.y()));
+        if (!state.polygon.isEmpty())
+        {
+            QStringList points;
+            foreach (QPointF const& p, state.polygon)
+                points << number(p.x()) + "," + number(p.y());
+            xml.writeAttribute("route", points.join(' '));
+        }
+        break;
+    case ItemState::Text:
+        xml.writeEmptyElement("Text");
+        xml.writeAttribute("id", QString::number(state.id));
+        xml.writeAttribute("Name", state.text);
+        xml.writeAttribute("x", number(state.pos.x()));
+        xml.writeAttribute("y", number(state.pos.y()));
+        break;
+    case ItemState::Pixmap:
+        if (!writtenImages.contains(state.image))
+        {
+            writtenImages.insert(state.image);
+            xml.writeStartElement("Image");
+            xml.writeAttribute("key", QString::fromLatin1(state.image.toHex()));
+            xml.writeCharacters(QString::fromLatin1(ImageStore::encoded(state.image).toBase64()));
+            xml.writeEndElement();
+        }
+        xml.writeEmptyElement("Pixmap");
+        xml.writeAttribute("id", QString::number(state.id));
+        xml.writeAttribute("image", QString::fromLatin1(state.image.toHex()));
+        xml.writeAttribute("x", number(state.pos.x()));
+        xml.writeAttribute("y", number(state.pos.y()));
+        xml.writeAttribute("z", number(state.z));
+        break;
+    default:
+        break;
+    }
+}
+
+bool XmlDocumentWriter::finish()
+{
+    xml.writeEndElement();
+    xml.writeEndElement();
+    xml.writeEndDocument();
+    return !xml.hasError();
+}
+
+XmlDocumentReader::XmlDocumentReader(QIODevice *device)
+    : xml(device)
+{
+}
+
+bool XmlDocumentReader::readItem(ItemState *state)
+{
+    if (!readElement(state))
+        return false;
+    if (state->id < 0)
+    {
+        state->id = handOut();
+    }
+    else if (isHandedOut(state->id))
+    {
+        int id = handOut();
+        renumbered.insert(state->id, id);
+        state->id = id;
+    }
+    else
+    {
+        maxId = qMax(maxId, state->id);
+    }
+    if (state->kind == ItemState::Connector)
+    {
+        state->startId = renumbered.value(state->startId, state->startId);
+        state->endId = renumbered.value(state->endId, state->endId);
+    }
+    return true;
+}
+
+int XmlDocumentReader::handOut()
+{
+    int id = ++maxId;
+    if (!handedOut.isEmpty() && handedOut.last().second == id - 1)
+        handedOut.last().second = id;
+    else
+        handedOut.append(qMakePair(id, id));
+    return id;
+}
+
+bool XmlDocumentReader::isHandedOut(int id) const
+{
+    // maxId only grows, so the runs are in order
+    QVector<QPair<int, int> >::const_iterator run = std::upper_bound(
+                handedOut.constBegin(), handedOut.constEnd(), qMakePair(id, INT_MAX));
+    return run != handedOut.constBegin() && (run - 1)->second >= id;
+}
+
+bool XmlDocumentReader::readElement(ItemState *state)
+{
+    while (!xml.atEnd())
+    {
+        if (xml.readNext() != QXmlStreamReader::StartElement)
+            continue;
+
+        QXmlStreamAttributes attributes = xml.attributes();
+        QStringRef name = xml.name();
+        *state = ItemState();
+        if (name == QLatin1String("CustomItem"))
+        {
+            state->kind = ItemState::Shape;
+            state->fields = ItemState::Position;
+            state->id = attributes.value("id").toInt();
+            state->customType = attributes.value("type").toInt();
+            state->pos = QPointF(attributes.value("x").toDouble(), attributes.value("y").toDouble());
+            return true;
+        }
+        if (name == QLatin1String("Arrow"))
+        {
+            state->kind = ItemState::Connector;
+            state->fields = ItemState::Geometry | ItemState::Style | ItemState::Links;
+            state->id = attributes.hasAttribute("id") ? attributes.value("id").toInt() : -1;
+            state->startId = attributes.value("startItemId").toInt();
+            state->endId = attributes.value("endItemId").toInt();
+            state->color = QColor(attributes.value("lineColor").toString());
+            state->pos = QPointF(attributes.value("intersectX").toDouble(), attributes.value("intersectY").toDouble());
+            foreach (QStringRef const& point, attributes.value("route").split(' ', QString::SkipEmptyParts))
+            {
+                QVector<QStringRef> xy = point.split(',');
+                if (xy.size() == 2)
+                    state->polygon << QPointF(xy.at(0).toDouble(), xy.at(1).toDouble());
+            }
+            return true;
+        }
+        if (name == QLatin1String("Text") || name == QLatin1String("CustomTextItem"))
+        {
+            state->kind = ItemState::Text;
+            state->fields = ItemState::Position | ItemState::Content;
+            state->id = attributes.hasAttribute("id") ? attributes.value("id").toInt() : -1;
+            state->text = attributes.value("Name").toString();
+            state->pos = QPointF(attributes.value("x").toDouble(), attributes.value("y").toDouble());
+            return true;
+        }
+        if (name == QLatin1String("Image"))
+        {
+            QByteArray key = QByteArray::fromHex(attributes.value("key").toLatin1());
+            QByteArray data = QByteArray::fromBase64(xml.readElementText().toLatin1());
+            ImageStore::insertEncoded(key, data);
+            continue;
+        }
+        if (name == QLatin1String("Pixmap"))
+        {
+            state->kind = ItemState::Pixmap;
+            state->fields = ItemState::Position | ItemState::Content | ItemState::Stacking;
+            state->id = attributes.value("id").toInt();
+            state->image = QByteArray::fromHex(attributes.value("image").toLatin1());
+            state->pos = QPointF(attributes.value("x").toDouble(), attributes.value("y").toDouble());
+            state->z = attributes.value("z").toDouble();
+            return true;
+        }
+    }
+    return false;
+}
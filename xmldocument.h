@@ -0,0 +1,58 @@
+#ifndef XMLDOCUMENT_H
+#define XMLDOCUMENT_H
+
+#include "itemstate.h"
+
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QVector>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+
+class QIODevice;
+
+// Streaming access to the XML document schema
+//   <scene><Scene><CustomItem/>...<Arrow/>...<Text/>...</Scene></scene>
+// Items are written and read one element at a time, so neither side holds
+// more than the current element in memory. Each distinct image is written
+// once, as an <Image> element ahead of the first <Pixmap> using it.
+class XmlDocumentWriter
+{
+public:
+    explicit XmlDocumentWriter(QIODevice *device);
+
+    void writeItem(ItemState const& state);
+    bool finish();
+
+private:
+    QXmlStreamWriter xml;
+    QSet<QByteArray> writtenImages;
+};
+
+// Older files have ids only on their shapes. Items without one are numbered
+// as they are read, above every id seen so far. A later item whose id was
+// already handed out that way is numbered afresh, and the arrows after it
+// are pointed at its new id. Only the runs of handed-out ids and the ids
+// numbered afresh are kept, never the items.
+class XmlDocumentReader
+{
+public:
+    explicit XmlDocumentReader(QIODevice *device);
+
+    bool readItem(ItemState *state);
+    bool hasError() const { return xml.hasError(); }
+    QString errorString() const { return xml.errorString(); }
+
+private:
+    bool readElement(ItemState *state);
+    int handOut();
+    bool isHandedOut(int id) const;
+
+    QXmlStreamReader xml;
+    QVector<QPair<int, int> > handedOut;    // ascending [first, last] runs
+    QHash<int, int> renumbered;             // id in the file -> id
+    int maxId = -1;
+};
+
+#endif // XMLDOCUMENT_H